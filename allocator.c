@@ -12,418 +12,3369 @@
  * (Everything after this point will use your custom allocator -- be careful!)
  */
 
+#define _GNU_SOURCE /* mremap */
+
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <time.h>
 
 #include "allocator.h"
+#include "allocator_inline.h"
 #include "logger.h"
 
-#define ALIGN_SIZE 8
+#define ALIGN_SIZE CA_ALIGN_SIZE
 #define BLOCK_ALIGN 4
 
+/**
+ * Specialized builds define ALLOCATOR_ENGINE to one of the placement engines
+ * (e.g. -DALLOCATOR_ENGINE=best_fit) to call it directly instead of through
+ * the configured function pointer, and set ALLOCATOR_SCRIBBLE_SUPPORT to 0 to
+ * compile out scribbling.
+ */
+#ifndef ALLOCATOR_SCRIBBLE_SUPPORT
+#define ALLOCATOR_SCRIBBLE_SUPPORT 1
+#endif
+
+/* ALLOCATOR_ENGINE gives the engine's unprefixed name; this is its function */
+#define ENGINE_FN(name) ENGINE_FN_(name)
+#define ENGINE_FN_(name) ca_##name
+#define ENGINE_NAME(name) ENGINE_NAME_(name)
+#define ENGINE_NAME_(name) #name
+
+/**
+ * Size of the static bootstrap arena in .bss, which holds the first region
+ * so short-lived programs can run without mapping any. Set with the
+ * BOOTSTRAP_SIZE make variable; 0, the default, leaves it out.
+ */
+#ifndef ALLOCATOR_BOOTSTRAP_SIZE
+#define ALLOCATOR_BOOTSTRAP_SIZE 0
+#endif
+_Static_assert(ALLOCATOR_BOOTSTRAP_SIZE % 4096 == 0, "bootstrap arena must be whole pages");
+
+#define ROUTES_MAX 8 /*!< Size ranges that can be given their own engine */
+#define TAGS_MAX 256 /*!< Distinct tags alloc_tag_set can hand out */
+
+#define SNAPSHOT_SLOTS 1024 /*!< Tags + sites a heap snapshot can hold (power of 2) */
+#define SNAPSHOT_REPORT_TOP 20 /*!< Growing entries printed by heap_snapshot_diff */
+#define HEAP_REPORT_TOP 10 /*!< Tags and sites listed in a heap report */
+
+_Static_assert(sizeof(struct mem_block) == 100, "block header must stay 100 bytes");
+_Static_assert(offsetof(struct mem_block, refs) == sizeof(struct mem_block) - sizeof(uint32_t),
+        "the reference count must end the header, right before the data");
+
+#define DETERMINISTIC_BASE 0x100000000000UL /*!< Default base of the deterministic reservation */
+#define DETERMINISTIC_RESERVE (64UL << 30) /*!< Address space reserved in deterministic mode */
+#define DETERMINISTIC_EXTENTS 4096 /*!< Free ranges tracked in deterministic mode */
+
+#define NEAR_SCAN_BLOCKS 64 /*!< Blocks looked at on each side of a placement hint */
+#define WARM_WINDOW 4096 /*!< Allocations and frees after which an untouched region is cold */
+#define HEAPS_MAX 64 /*!< Thread heaps (ALLOCATOR_HEAPS); later threads share them */
+#define HEAP_SLACK (256UL << 10) /*!< Unused bytes a thread heap may always keep */
+
+#define REGION_HEADROOM (1UL << 20) /*!< Address space reserved after the newest region to grow into */
+
+#define HUGEPAGE_SIZE (2UL * 1024 * 1024) /*!< Size of a transparent hugepage */
+#define HUGEPAGE_MAX_PAGES 512 /*!< Small pages per hugepage (with 4 KB pages) */
+#define HUGEPAGE_SLOTS 1024 /*!< Max hugepages the filler can track (2 GB) */
+
 static struct mem_block *g_head = NULL; /*!< Start (head) of our linked list */
 static struct mem_block *g_tail = NULL; /*!< End (tail) of our linked list */
 
 static unsigned long g_allocations = 0; /*!< Allocation counter */
 static unsigned long g_regions = 0; /*!< regions counter */
 static unsigned long g_splits = 0;/*number of blocks split for naming purposes*/
+static unsigned long g_sample_countdown = 0; /*!< Allocations left until the next sample */
 
-pthread_mutex_t alloc_mutex = PTHREAD_MUTEX_INITIALIZER; /*< Mutex for protecting the linked list */
+static pthread_mutex_t alloc_mutex = PTHREAD_MUTEX_INITIALIZER; /*< Mutex for protecting the linked list */
 
 /**
- * Given a free block, this function will split it into two pieces and update
- * the linked list.
- *
- * @param block the block to split
- * @param size new size of the first block after the split is complete,
- * including header sizes. The size of the second block will be the original
- * block's size minus this parameter.
- *
- * @return address of the resulting second block (the original address will be
- * unchanged) or NULL if the block cannot be split.
+ * A 2 MB hugepage owned by the filler. Regions smaller than a hugepage are
+ * carved out of these in page-sized units; the bitmap tracks which pages are
+ * handed out so partially used hugepages can be packed and empty ones
+ * released whole.
  */
-struct mem_block *split_block(struct mem_block *block, size_t size)
-{   
-    size_t min_sz = sizeof(struct mem_block) + BLOCK_ALIGN;
+struct hugepage {
+    char *base; /*!< Start of the hugepage (2 MB aligned) */
+    uint64_t used[HUGEPAGE_MAX_PAGES / 64]; /*!< Bitmap of pages in use */
+    unsigned int used_pages; /*!< Number of set bits in used */
+    unsigned int longest_free; /*!< Longest run of free pages */
+};
 
-    if(size < min_sz){
-        return NULL;
+static struct hugepage g_hugepages[HUGEPAGE_SLOTS]; /*!< Filler hugepages */
+static unsigned int g_num_hugepages = 0; /*!< Hugepages currently held */
+
+/**
+ * Per-thread byte counters, only ever incremented. The initial-exec TLS model
+ * makes each update a single add and lets callers read them with plain loads
+ * through the pointers from allocator_thread_allocatedp() and friends.
+ */
+static __thread uint64_t t_allocated __attribute__((tls_model("initial-exec"))) = 0;
+static __thread uint64_t t_deallocated __attribute__((tls_model("initial-exec"))) = 0;
+
+static __thread unsigned int t_thread_id = 0; /*!< Small per-thread id, 0 until assigned */
+static unsigned int g_threads = 0; /*!< Thread ids handed out so far */
+
+static int g_trace_fd = -1; /*!< Trace file, or -1 if tracing is off */
+static char g_trace_buf[16384]; /*!< Trace lines not yet written */
+static size_t g_trace_len = 0; /*!< Bytes used in g_trace_buf */
+
+/**
+ * A free range of the deterministic reservation.
+ */
+struct extent {
+    uintptr_t start;
+    uintptr_t end;
+};
+
+static char *g_det_base = NULL; /*!< Start of the deterministic reservation */
+static uintptr_t g_det_top = 0; /*!< Everything from here to the end is unused */
+static struct extent g_det_free[DETERMINISTIC_EXTENTS]; /*!< Free ranges below g_det_top, by address */
+static unsigned int g_det_num_free = 0; /*!< Number of entries in g_det_free */
+static bool g_det_full_reported = false; /*!< Whether det_full() has printed its warning */
+
+#if ALLOCATOR_BOOTSTRAP_SIZE > 0
+static char g_bootstrap[ALLOCATOR_BOOTSTRAP_SIZE] __attribute__((aligned(4096)));
+static bool g_bootstrap_in_use = false; /*!< Whether the arena is a region right now */
+#endif
+
+static void *(*g_page_map)(size_t size, size_t align) = NULL; /*!< Replacement page source */
+static int (*g_page_unmap)(void *addr, size_t size) = NULL; /*!< Releases g_page_map pages */
+static int (*g_page_grow)(void *addr, size_t size, size_t new_size) = NULL; /*!< Grows them in place */
+
+/**
+ * Where a region's pages came from. Plain mmap regions can be grown in place
+ * with mremap, and provided ones when the page provider can grow them.
+ */
+enum region_kind {
+    REGION_MMAP, /*!< Its own anonymous mapping */
+    REGION_FILLER, /*!< Pages of a filler hugepage */
+    REGION_RESERVED, /*!< Part of the deterministic reservation */
+    REGION_PROVIDED, /*!< From a page provider set by allocator_set_page_provider */
+    REGION_FILE, /*!< Shared mapping of an unlinked file in the overflow directory */
+    REGION_BOOTSTRAP, /*!< The static bootstrap arena; never unmapped */
+};
+
+/**
+ * Record of a mapped region. The directory points to the records sorted by
+ * base address so the region containing any address can be found by binary
+ * search. The records themselves stay put, linked in list order.
+ */
+struct region {
+    char *base; /*!< Start of the region (its first block header) */
+    size_t size; /*!< Size of the region */
+    unsigned long id; /*!< region_id of the region's blocks */
+    enum region_kind kind; /*!< Where the pages came from */
+    size_t headroom; /*!< PROT_NONE bytes reserved right after the region */
+    unsigned long stamp; /*!< g_clock when a block in it was last allocated or freed */
+    struct mem_block *warm; /*!< Block most recently freed into it (warm placement only) */
+    unsigned long live; /*!< Allocated blocks in it */
+    struct mem_block *last; /*!< Its last block in the list */
+    uint16_t tag; /*!< Tag every block in it carries (0: untagged) */
+    uint16_t owner; /*!< Thread heap it belongs to (0: the global pool) */
+    size_t in_use; /*!< Bytes of its allocated blocks, headers included */
+    struct mem_block **index; /*!< Per page, the block holding its start (allocator_block_of) */
+    size_t index_pages; /*!< Pages covered by index */
+    struct region *next; /*!< Next region in the list (NULL: none), or next spare record */
+    struct region *prev; /*!< Previous region in the list (NULL: none) */
+};
+
+static struct region **g_region_dir = NULL; /*!< Mapped regions' records, sorted by base */
+static size_t g_region_count = 0; /*!< Entries in g_region_dir */
+static size_t g_region_cap = 0; /*!< Capacity of g_region_dir */
+static struct region *g_region_first = NULL; /*!< First region in the list */
+static struct region *g_region_last = NULL; /*!< Last region in the list */
+static struct region *g_region_spare = NULL; /*!< Records of released regions, for reuse */
+
+static unsigned long g_extend_attempts = 0; /*!< In-place region growths tried */
+static unsigned long g_extend_successes = 0; /*!< In-place region growths that worked */
+static size_t g_mapped_bytes = 0; /*!< Bytes in all mapped regions */
+static size_t g_hugepage_bytes = 0; /*!< Region bytes served by the filler */
+static unsigned long g_file_regions = 0; /*!< Regions in the file-backed overflow tier */
+static size_t g_file_bytes = 0; /*!< Bytes in those regions */
+static unsigned long g_near_requests = 0; /*!< malloc_near calls with a usable hint */
+static unsigned long g_near_hits = 0; /*!< malloc_near calls placed next to their hint */
+static unsigned long g_clock = 0; /*!< Allocations and frees seen by warm placement */
+static uint64_t g_alloc_clock = 0; /*!< Allocations so far; blocks' birth stamps */
+static uint64_t g_lifetimes[CA_LIFETIME_CLASSES][CA_LIFETIME_BUCKETS]; /*!< See allocator_lifetimes */
+static unsigned long g_warm_hits = 0; /*!< Allocations placed in the thread's warm region */
+static size_t g_fit_bound = SIZE_MAX; /*!< No region has more free bytes than this (see fit_start) */
+static size_t g_fit_seen = 0; /*!< Most free bytes in a region seen by the current engine walk */
+static struct region *g_fit_next = NULL; /*!< Next region the walk enters */
+static unsigned long g_indexed_regions = 0; /*!< Regions with a page index for merges to update */
+static __thread bool t_disabled = false; /*!< Whether this thread holds the lock via allocator_disable */
+
+/* Base of the region the thread last freed into (warm placement only) */
+static __thread char *t_warm_base = NULL;
+
+static char g_tags[TAGS_MAX][32]; /*!< Tag names; tag id n is g_tags[n - 1] */
+static unsigned int g_num_tags = 0; /*!< Tags handed out so far */
+static __thread uint16_t t_tag = 0; /*!< Calling thread's current tag */
+
+/**
+ * Bytes held and in use by one thread heap (ALLOCATOR_HEAPS), summed over the
+ * regions it owns. Entry 0 is the global pool.
+ */
+static struct {
+    size_t held;
+    size_t in_use;
+} g_heaps[HEAPS_MAX + 1];
+
+static unsigned long g_heap_releases = 0; /*!< Regions given up to the global pool */
+static unsigned long g_heap_adoptions = 0; /*!< Regions taken over from the global pool */
+static __thread uint16_t t_heap = 0; /*!< Calling thread's heap (0 until assigned, or heaps off) */
+
+/**
+ * A size range with its own placement engine. Allocations are routed by
+ * usable size to the first route whose limit they don't exceed.
+ */
+struct route {
+    size_t limit; /*!< Largest request size routed here */
+    size_t usable_limit; /*!< Usable size of a block for a request of `limit` bytes */
+    void *(*fit)(size_t size); /*!< Engine, or NULL for the configured algorithm */
+    bool direct; /*!< Always map a fresh region (the "mmap" engine) */
+    const char *engine; /*!< Engine name, for stats */
+};
+
+/**
+ * Allocator configuration, read once from the environment on first use.
+ */
+struct allocator_config {
+    bool loaded; /*!< Whether the environment has been read yet */
+    void *(*engine)(size_t size); /*!< Placement engine used by reuse() */
+    bool scribble; /*!< Fill new allocations with 0xAA */
+    bool hugepages; /*!< Pack small regions into filler hugepages */
+    unsigned long sample_interval; /*!< Sample one in this many allocations (0: off) */
+    bool deterministic; /*!< Map regions from a fixed reservation, lowest address first */
+    uintptr_t deterministic_base; /*!< Start of the deterministic reservation */
+    char trace_path[256]; /*!< File allocations are traced to (empty: off) */
+    int report_signal; /*!< Signal that requests a heap report (0: off) */
+    char report_path[256]; /*!< File heap reports are appended to (empty: stderr) */
+    bool warm; /*!< Prefer the region the thread last freed into */
+    bool heaps; /*!< Give each thread its own regions */
+    unsigned int emptiness; /*!< Percent free at which a region leaves its heap */
+    size_t overflow_budget; /*!< Anonymous region bytes before overflow kicks in (0: off) */
+    size_t overflow_threshold; /*!< Smallest region that may overflow to a file */
+    char overflow_dir[256]; /*!< Directory overflow files are created in */
+    struct route routes[ROUTES_MAX + 1]; /*!< Size ranges, by limit; the last catches all */
+    unsigned int num_routes; /*!< Entries in routes (0: route everything to engine) */
+};
+
+/**
+ * Per-route counters, indexed like g_config.routes.
+ */
+static struct {
+    unsigned long allocations;
+    unsigned long frees;
+    size_t live_bytes;
+} g_route_stats[ROUTES_MAX + 1];
+
+/**
+ * Placement engines selectable by name through ALLOCATOR_ALGORITHM.
+ */
+static const struct {
+    const char *name;
+    void *(*fit)(size_t size);
+} g_engines[] = {
+    { "first_fit", ca_first_fit },
+    { "best_fit", ca_best_fit },
+    { "worst_fit", ca_worst_fit },
+};
+
+static struct allocator_config g_config = {
+    .engine = ca_first_fit,
+    .deterministic_base = DETERMINISTIC_BASE,
+    .overflow_threshold = 1UL << 20,
+    .overflow_dir = "/var/tmp",
+    .emptiness = 25,
+};
+
+/**
+ * Set by the report signal handler; the next allocator call notices it and
+ * writes the heap report outside the lock.
+ */
+static volatile sig_atomic_t g_report_pending = 0;
+
+static void report_pending(void);
+
+static void report_signal_handler(int signo)
+{
+    (void) signo;
+    g_report_pending = 1;
+}
+
+/**
+ * Parses a signal given as a number or a name such as SIGUSR2 or USR2.
+ *
+ * @return the signal number, or 0 if it isn't recognized
+ */
+static int parse_signal(const char *value, size_t len)
+{
+    static const struct {
+        const char *name;
+        int signo;
+    } signals[] = {
+        { "USR1", SIGUSR1 },
+        { "USR2", SIGUSR2 },
+        { "HUP", SIGHUP },
+        { "WINCH", SIGWINCH },
+    };
+    if (len > 3 && strncmp(value, "SIG", 3) == 0) {
+        value += 3;
+        len -= 3;
     }
-    if(block->free == false){
-        return NULL;
+    if (len > 0 && value[0] >= '0' && value[0] <= '9') {
+        return atoi(value);
     }
-    size_t rm_sz = block->size - size;
-    if(rm_sz < 104){
-        return NULL;
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        if (strlen(signals[i].name) == len && strncmp(signals[i].name, value, len) == 0) {
+            return signals[i].signo;
+        }
     }
-    
-    struct mem_block *new_block = (void *) block + size;
-    LOG("Splitting block: %p\n", new_block);
-    if(block == g_tail){
-        block->next = new_block;
-        new_block->prev = block;
-        new_block->next = NULL;
-        g_tail = new_block;
+    return 0;
+}
+
+/**
+ * Parses a byte count with an optional K, M or G suffix.
+ */
+static size_t parse_size(const char *value)
+{
+    char *end;
+    size_t size = strtoul(value, &end, 10);
+    switch (*end) {
+    case 'G': case 'g':
+        size <<= 10;
+        /* fall through */
+    case 'M': case 'm':
+        size <<= 10;
+        /* fall through */
+    case 'K': case 'k':
+        size <<= 10;
     }
-    else{
-        new_block->next = block->next;
-        block->next->prev = new_block;
-        new_block->prev = block;
-        block->next = new_block;
+    return size;
+}
+
+/**
+ * Parses a route list such as "256=first_fit/64K=best_fit/1G=mmap": entries
+ * separated by '/', each a request size limit (or '*' for no limit) and an
+ * engine name. Sizes above every limit use the configured algorithm.
+ */
+static void config_set_routes(const char *value, size_t value_len)
+{
+    const char *end = value + value_len;
+    g_config.num_routes = 0;
+    while (value < end && g_config.num_routes < ROUTES_MAX) {
+        const char *entry_end = memchr(value, '/', end - value);
+        if (entry_end == NULL) {
+            entry_end = end;
+        }
+        const char *name = memchr(value, '=', entry_end - value);
+        if (name == NULL) {
+            break;
+        }
+        name++;
+        size_t name_len = entry_end - name;
+
+        struct route route = {
+            .limit = *value == '*' ? SIZE_MAX : parse_size(value),
+        };
+        route.usable_limit = route.limit == SIZE_MAX ? SIZE_MAX
+            : ca_block_size(route.limit) - sizeof(struct mem_block);
+        if (name_len == 4 && strncmp(name, "mmap", name_len) == 0) {
+            route.direct = true;
+            route.engine = "mmap";
+        }
+        for (size_t i = 0; i < sizeof(g_engines) / sizeof(g_engines[0]); i++) {
+            if (strlen(g_engines[i].name) == name_len && strncmp(g_engines[i].name, name, name_len) == 0) {
+                route.fit = g_engines[i].fit;
+                route.engine = g_engines[i].name;
+            }
+        }
+        if (route.engine != NULL) {
+            g_config.routes[g_config.num_routes++] = route;
+        }
+        value = entry_end + 1;
     }
 
-    snprintf(new_block->name, 32, "Split block %lu", g_splits++);
-    new_block->size = rm_sz;
-    new_block->free = true;
-    new_block->region_id = block->region_id;
-    block->size = size;
-    LOG("returning from split_block: %p\n", new_block);
-    return new_block;
+    if (g_config.num_routes > 0 && g_config.routes[g_config.num_routes - 1].limit != SIZE_MAX) {
+        g_config.routes[g_config.num_routes++] = (struct route) {
+            .limit = SIZE_MAX, .usable_limit = SIZE_MAX, .engine = "algorithm",
+        };
+    }
+}
+
+static void config_set_path(char *path, size_t path_size, const char *value, size_t value_len)
+{
+    if (value_len >= path_size) {
+        value_len = path_size - 1;
+    }
+    memcpy(path, value, value_len);
+    path[value_len] = '\0';
 }
 
 /**
- * Given a free block, this function attempts to merge it with neighboring
- * blocks --- both the previous and next neighbors --- and update the linked
- * list accordingly.
+ * Applies a single configuration option.
  *
- * @param block the block to merge
+ * @param key option name (not NUL-terminated)
+ * @param key_len length of the option name
+ * @param value option value, terminated by a NUL or a ','
  *
- * @return address of the merged block or NULL if the block cannot be merged.
+ * @return true if the option was recognized
  */
-struct mem_block *merge_block(struct mem_block *block)
+static bool config_set(const char *key, size_t key_len, const char *value)
 {
-
-    if(block->next != NULL){
-        if(block->next->free == true && block->next->region_id == block->region_id){//if next and block are in same region
-            // LOG("2 blocks down (block->next->next): %p\n", block->next->next);
-            block->size = block->size + block->next->size;
-            // LOG("merging block->next + block = %zu\n", block->size);
-            // LOG("merge block: %p\n", block);
-            if(block->next == g_tail){
-                g_tail = block;
-                block->next->prev = NULL;
-                block->next = NULL;
-            }
-            else{
-                // LOG("before pointing to block->next->next...: %p\n", block->next);
-                block->next = block->next->next;
-                block->next->prev = block;
-                // LOG("after: block->next: %p\n", block->next);
+    size_t value_len = strcspn(value, ",");
+    if (key_len == 9 && strncmp(key, "algorithm", key_len) == 0) {
+        /* Unknown algorithms disable reuse, like they always have */
+        g_config.engine = NULL;
+        for (size_t i = 0; i < sizeof(g_engines) / sizeof(g_engines[0]); i++) {
+            if (strlen(g_engines[i].name) == value_len
+                    && strncmp(g_engines[i].name, value, value_len) == 0) {
+                g_config.engine = g_engines[i].fit;
             }
         }
-    }
-    if(block->prev != NULL){
-        if(block->prev->free == true && block->prev->region_id == block->region_id){//if prev and block are in same region
-            // LOG("2 blocks down from previous block(block->next): %p\n", block->next);
-            block->prev->size = block->prev->size + block->size;
-            // LOG("merging block prev + block = %zu\n", block->prev->size);
-            if(block == g_tail){
-                g_tail = block->prev;
-                block->prev->next = NULL;
-                block->prev = NULL;
+    } else if (key_len == 8 && strncmp(key, "scribble", key_len) == 0) {
+        g_config.scribble = atoi(value) == 1;
+    } else if (key_len == 9 && strncmp(key, "hugepages", key_len) == 0) {
+        g_config.hugepages = atoi(value) == 1;
+    } else if (key_len == 6 && strncmp(key, "sample", key_len) == 0) {
+        g_config.sample_interval = strtoul(value, NULL, 10);
+    } else if (key_len == 13 && strncmp(key, "deterministic", key_len) == 0) {
+        g_config.deterministic = atoi(value) == 1;
+    } else if (key_len == 18 && strncmp(key, "deterministic_base", key_len) == 0) {
+        g_config.deterministic_base = strtoul(value, NULL, 0);
+    } else if (key_len == 13 && strncmp(key, "report_signal", key_len) == 0) {
+        g_config.report_signal = parse_signal(value, value_len);
+    } else if (key_len == 11 && strncmp(key, "report_path", key_len) == 0) {
+        config_set_path(g_config.report_path, sizeof(g_config.report_path), value, value_len);
+    } else if (key_len == 6 && strncmp(key, "routes", key_len) == 0) {
+        config_set_routes(value, value_len);
+    } else if (key_len == 4 && strncmp(key, "warm", key_len) == 0) {
+        bool warm = atoi(value) == 1;
+        if (warm && !g_config.warm) {
+            /* Frees made while it was off didn't keep the regions' warm
+             * blocks up to date, so they may have been merged away */
+            for (size_t i = 0; i < g_region_count; i++) {
+                g_region_dir[i]->warm = NULL;
             }
-            else{
-                // LOG("before pointing to prev block to block->next...: %p\n", block->prev->next);
-                block->prev->next = block->next;
-                block->prev->next->prev = block->prev;
-                // LOG("after: block->prev->next: %p\n", block->prev->next);
-            }    
         }
+        g_config.warm = warm;
+    } else if (key_len == 5 && strncmp(key, "heaps", key_len) == 0) {
+        g_config.heaps = atoi(value) == 1;
+    } else if (key_len == 9 && strncmp(key, "emptiness", key_len) == 0) {
+        g_config.emptiness = strtoul(value, NULL, 10);
+    } else if (key_len == 15 && strncmp(key, "overflow_budget", key_len) == 0) {
+        g_config.overflow_budget = parse_size(value);
+    } else if (key_len == 18 && strncmp(key, "overflow_threshold", key_len) == 0) {
+        g_config.overflow_threshold = parse_size(value);
+    } else if (key_len == 12 && strncmp(key, "overflow_dir", key_len) == 0) {
+        config_set_path(g_config.overflow_dir, sizeof(g_config.overflow_dir), value, value_len);
+    } else if (key_len == 5 && strncmp(key, "trace", key_len) == 0) {
+        config_set_path(g_config.trace_path, sizeof(g_config.trace_path), value, value_len);
+    } else {
+        return false;
     }
-    if(block == g_head && block == g_tail){//if it was only block in memory unmap
-        g_head = NULL;
-        g_tail = NULL;
-        if(munmap(block, block->size) == -1){
-            perror("munmap");
-            return NULL;
+    return true;
+}
+
+/**
+ * Reads the configuration from the environment. ALLOCATOR_CONF holds
+ * comma-separated key:value options (e.g. "algorithm:best_fit,scribble:1");
+ * the individual ALLOCATOR_* variables override it. Must be called with the
+ * allocator lock held.
+ */
+static void config_load(void)
+{
+    char *conf = getenv("ALLOCATOR_CONF");
+    while (conf != NULL && *conf != '\0') {
+        char *sep = strchr(conf, ':');
+        if (sep == NULL) {
+            break;
+        }
+        config_set(conf, sep - conf, sep + 1);
+        conf = strchr(sep, ',');
+        if (conf != NULL) {
+            conf++;
         }
     }
-    else if((block->next != NULL && block->next->region_id != block->region_id) && (block->prev != NULL && block->prev->region_id != block->region_id)){//prev & next are in diff regions
-        block->prev->next = block->next;
-        block->next->prev = block->prev;
-        if(munmap(block, block->size) == -1){
-            perror("munmap");
-            return NULL;
+
+    static const struct {
+        const char *env;
+        const char *key;
+    } overrides[] = {
+        { "ALLOCATOR_ALGORITHM", "algorithm" },
+        { "ALLOCATOR_SCRIBBLE", "scribble" },
+        { "ALLOCATOR_HUGEPAGES", "hugepages" },
+        { "ALLOCATOR_SAMPLE", "sample" },
+        { "ALLOCATOR_DETERMINISTIC", "deterministic" },
+        { "ALLOCATOR_DETERMINISTIC_BASE", "deterministic_base" },
+        { "ALLOCATOR_REPORT_SIGNAL", "report_signal" },
+        { "ALLOCATOR_REPORT_PATH", "report_path" },
+        { "ALLOCATOR_TRACE", "trace" },
+        { "ALLOCATOR_ROUTES", "routes" },
+        { "ALLOCATOR_WARM", "warm" },
+        { "ALLOCATOR_HEAPS", "heaps" },
+        { "ALLOCATOR_EMPTINESS", "emptiness" },
+        { "ALLOCATOR_OVERFLOW_BUDGET", "overflow_budget" },
+        { "ALLOCATOR_OVERFLOW_THRESHOLD", "overflow_threshold" },
+        { "ALLOCATOR_OVERFLOW_DIR", "overflow_dir" },
+    };
+    for (size_t i = 0; i < sizeof(overrides) / sizeof(overrides[0]); i++) {
+        char *value = getenv(overrides[i].env);
+        if (value != NULL) {
+            config_set(overrides[i].key, strlen(overrides[i].key), value);
         }
     }
-    else if(block->prev != NULL && block == g_tail && block->prev->region_id != block->region_id){//if block is tail and only block in region
-        g_tail = block->prev;
-        block->prev->next = NULL;
-        block->prev = NULL;
-        if(munmap(block, block->size) == -1){
-            perror("munmap");
-            return NULL;
+    g_config.loaded = true;
+
+    if (g_config.trace_path[0] != '\0') {
+        g_trace_fd = open(g_config.trace_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (g_trace_fd == -1) {
+            perror("open");
         }
     }
-    else if(block->next != NULL && block == g_head && block->next->region_id != block->region_id){//if block is head and only block in region
-        g_head = block->next;
-        block->next->prev = NULL;
-        block->next = NULL;
-        if(munmap(block, block->size) == -1){
-            perror("munmap");
-            return NULL;
+
+    if (g_config.report_signal > 0) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = report_signal_handler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(g_config.report_signal, &action, NULL) == -1) {
+            perror("sigaction");
         }
     }
-    return block;
 }
 
 /**
- * Given a block size (header + data), locate a suitable location using the
- * first fit free space management algorithm.
+ * Finds an option the way config_load() would see it, without applying
+ * anything: the ALLOCATOR_* variable `env` if set, else the last `key` in
+ * ALLOCATOR_CONF.
  *
- * @param size size of the block (header + data)
+ * @param len set to the length of the value, which ends at a NUL or a ','
+ *
+ * @return the value, or NULL if the option isn't given
  */
-void *first_fit(size_t size)
+static const char *config_lookup(const char *env, const char *key, size_t *len)
 {
-    struct mem_block *current = g_head;
-    while(current != NULL){
-        if(size <= current->size && current->free == true){
-            LOG("First fit: current name = %s\n", current->name);
-            return current;
+    const char *value = getenv(env);
+    if (value != NULL) {
+        *len = strlen(value);
+        return value;
+    }
+    size_t key_len = strlen(key);
+    for (const char *conf = getenv("ALLOCATOR_CONF"); conf != NULL && *conf != '\0'; ) {
+        const char *sep = strchr(conf, ':');
+        if (sep == NULL) {
+            break;
+        }
+        if ((size_t) (sep - conf) == key_len && strncmp(conf, key, key_len) == 0) {
+            value = sep + 1;
+            *len = strcspn(value, ",");
+        }
+        conf = strchr(sep, ',');
+        if (conf != NULL) {
+            conf++;
         }
-        // LOG("First fit: current name = %s\n", current->name);
-        // LOG("First fit: current is free = %d\n", current->free);
-        // LOG("First fit: current size = %zu\n", current->size);
-        current = current->next;
     }
-    return NULL;
+    return value;
 }
 
 /**
- * Given a block size (header + data), locate a suitable location using the
- * worst fit free space management algorithm. If there are ties (i.e., you find
- * multiple worst fit candidates with the same size), use the first candidate
- * found.
+ * Reserves the deterministic address range on first use. If the range can't
+ * be reserved at the configured base, deterministic mode is turned off.
  *
- * @param size size of the block (header + data)
+ * @return true if the reservation is in place
  */
-void *worst_fit(size_t size)
+static bool det_reserve(void)
 {
-    struct mem_block *current = g_head;
-    struct mem_block *worst = NULL;
-    ssize_t worst_size = INT_MIN;
-    while(current != NULL){
-        if(size <= current->size && current->free == true){
-            ssize_t diff = (ssize_t) current->size - size;
-            if(diff > worst_size){
-                worst = current;
-                worst_size = diff;
-            }
+    if (g_det_base != NULL) {
+        return true;
+    }
+    void *base = mmap((void *) g_config.deterministic_base, DETERMINISTIC_RESERVE, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+    if (base == MAP_FAILED || base != (void *) g_config.deterministic_base) {
+        perror("mmap (deterministic reservation)");
+        if (base != MAP_FAILED) {
+            munmap(base, DETERMINISTIC_RESERVE);
         }
-        current = current->next;
+        g_config.deterministic = false;
+        return false;
     }
-    return worst;
+    g_det_base = base;
+    g_det_top = (uintptr_t) base;
+    LOG("Deterministic reservation at %p\n", base);
+    return true;
 }
 
 /**
- * Given a block size (header + data), locate a suitable location using the
- * best fit free space management algorithm. If there are ties (i.e., you find
- * multiple best fit candidates with the same size), use the first candidate
- * found.
+ * Reports, once, that g_det_free has no room for another range. From then on
+ * some ranges are placed by the kernel or left unused, so later runs may no
+ * longer get the same addresses.
+ */
+static void det_full(void)
+{
+    if (!g_det_full_reported) {
+        g_det_full_reported = true;
+        fputs("allocator: deterministic extent table full, addresses may differ between runs\n",
+                stderr);
+    }
+}
+
+/**
+ * Removes [start, end) from the free extent at `index`, which must contain it.
+ * Taking from the middle splits the extent, so the caller must make sure
+ * there is room for one more.
+ */
+static void det_take(unsigned int index, uintptr_t start, uintptr_t end)
+{
+    struct extent *ext = &g_det_free[index];
+    if (ext->start < start && ext->end > end) {
+        /* Split the extent in two around the taken range */
+        memmove(ext + 1, ext, (g_det_num_free - index) * sizeof(struct extent));
+        g_det_num_free++;
+        ext[0].end = start;
+        ext[1].start = end;
+    } else if (ext->start < start) {
+        ext->end = start;
+    } else if (ext->end > end) {
+        ext->start = end;
+    } else {
+        memmove(ext, ext + 1, (g_det_num_free - index - 1) * sizeof(struct extent));
+        g_det_num_free--;
+    }
+}
+
+/**
+ * Hands out `size` bytes of the reservation at the lowest suitably aligned
+ * address, so the same sequence of requests always gets the same addresses.
+ * Ranges that would need another entry in a full g_det_free are passed over.
  *
- * @param size size of the block (header + data)
+ * @return start of the range, or MAP_FAILED if the reservation has no room
  */
-void *best_fit(size_t size)
+static void *det_map(size_t size, size_t align)
 {
-    struct mem_block *current = g_head;
-    struct mem_block *best = NULL;
-    size_t best_size = INT_MAX;
-    while(current != NULL){
-        if(size <= current->size && current->free == true){
-            ssize_t diff = (ssize_t) current->size - size;
-            if(diff < best_size){
-                best = current;
-                best_size = diff;
+    bool full = g_det_num_free == DETERMINISTIC_EXTENTS;
+    uintptr_t start = 0;
+    for (unsigned int i = 0; i < g_det_num_free; i++) {
+        uintptr_t aligned = (g_det_free[i].start + align - 1) & ~(align - 1);
+        if (aligned + size > g_det_free[i].end) {
+            continue;
+        }
+        if (full && aligned > g_det_free[i].start && aligned + size < g_det_free[i].end) {
+            det_full();
+            continue;
+        }
+        start = aligned;
+        det_take(i, start, start + size);
+        break;
+    }
+    if (start == 0) {
+        start = (g_det_top + align - 1) & ~(align - 1);
+        if (start + size > (uintptr_t) g_det_base + DETERMINISTIC_RESERVE) {
+            return MAP_FAILED;
+        }
+        if (start > g_det_top) {
+            /* The alignment gap below the range goes on the free list */
+            if (full) {
+                det_full();
+                return MAP_FAILED;
             }
+            g_det_free[g_det_num_free++] = (struct extent) { g_det_top, start };
         }
-        current = current->next;
+        g_det_top = start + size;
     }
-    return best;
+    if (mprotect((void *) start, size, PROT_READ | PROT_WRITE) == -1) {
+        perror("mprotect");
+        return MAP_FAILED;
+    }
+    return (void *) start;
 }
 
-void *reuse(size_t size)
+/**
+ * Returns a range to the reservation: its memory is released and it goes
+ * back on the free list, merged with any neighboring free ranges. If the
+ * list is full and nothing merges, the range stays reserved but unused.
+ */
+static int det_unmap(void *addr, size_t size)
 {
-    char *algo = getenv("ALLOCATOR_ALGORITHM");
-    if(algo == NULL){
-        algo = "first_fit";
+    uintptr_t start = (uintptr_t) addr, end = start + size;
+    if (madvise(addr, size, MADV_DONTNEED) == -1 || mprotect(addr, size, PROT_NONE) == -1) {
+        return -1;
     }
 
-    void *reused_block = NULL;
-
-    if (strcmp(algo, "first_fit") == 0) {
-        reused_block = first_fit(size);
-    } else if (strcmp(algo, "best_fit") == 0) {
-        reused_block = best_fit(size);
-    } else if (strcmp(algo, "worst_fit") == 0) {
-        reused_block = worst_fit(size);
+    unsigned int i = 0;
+    while (i < g_det_num_free && g_det_free[i].start < start) {
+        i++;
+    }
+    bool merge_prev = i > 0 && g_det_free[i - 1].end == start;
+    bool merge_next = i < g_det_num_free && g_det_free[i].start == end;
+    if (merge_prev && merge_next) {
+        g_det_free[i - 1].end = g_det_free[i].end;
+        memmove(&g_det_free[i], &g_det_free[i + 1], (g_det_num_free - i - 1) * sizeof(struct extent));
+        g_det_num_free--;
+    } else if (merge_prev) {
+        g_det_free[i - 1].end = end;
+    } else if (merge_next) {
+        g_det_free[i].start = start;
+    } else if (g_det_num_free < DETERMINISTIC_EXTENTS) {
+        memmove(&g_det_free[i + 1], &g_det_free[i], (g_det_num_free - i) * sizeof(struct extent));
+        g_det_free[i] = (struct extent) { start, end };
+        g_det_num_free++;
+    } else if (end == g_det_top) {
+        g_det_top = start;
+    } else {
+        det_full();
     }
 
-    if(reused_block != NULL){
-        split_block(reused_block, size);      
+    /* Give the topmost free range back to the unused part */
+    if (g_det_num_free > 0 && g_det_free[g_det_num_free - 1].end == g_det_top) {
+        g_det_top = g_det_free[--g_det_num_free].start;
     }
-    return reused_block;
+    return 0;
 }
 
-void *malloc_name(size_t size, char *name){
-    void *alloc = malloc(size);
-    if(alloc == NULL){
-        return NULL;
+static bool det_contains(void *addr)
+{
+    return g_det_base != NULL && (char *) addr >= g_det_base
+        && (char *) addr < g_det_base + DETERMINISTIC_RESERVE;
+}
+
+/**
+ * Maps `size` bytes of fresh pages aligned to `align` (a power of two no
+ * smaller than the page size). In deterministic mode they come from the
+ * fixed reservation instead of wherever the kernel puts them.
+ *
+ * @return start of the pages or MAP_FAILED
+ */
+static void *pages_map(size_t size, size_t align)
+{
+    if (g_page_map != NULL) {
+        return g_page_map(size, align);
+    }
+    if (g_config.deterministic && det_reserve()) {
+        void *pages = det_map(size, align);
+        if (pages != MAP_FAILED) {
+            return pages;
+        }
+        /* No room in the reservation: let the kernel place it */
+    }
+
+    /* Over-map so we can trim to an aligned start */
+    size_t page_size = getpagesize();
+    size_t map_size = align > page_size ? size + align : size;
+    char *raw = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED || map_size == size) {
+        return raw;
+    }
+    char *base = (char *) (((uintptr_t) raw + align - 1) & ~(align - 1));
+    if (base > raw) {
+        munmap(raw, base - raw);
+    }
+    if (raw + map_size > base + size) {
+        munmap(base + size, raw + map_size - (base + size));
+    }
+    return base;
+}
+
+/**
+ * Releases pages from pages_map().
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int pages_unmap(void *addr, size_t size)
+{
+    if (g_page_unmap != NULL) {
+        return g_page_unmap(addr, size);
+    }
+    if (det_contains(addr)) {
+        return det_unmap(addr, size);
+    }
+    return munmap(addr, size);
+}
+
+static bool hp_page_used(struct hugepage *hp, unsigned int page)
+{
+    return (hp->used[page / 64] >> (page % 64)) & 1;
+}
+
+static void hp_set_pages(struct hugepage *hp, unsigned int first, unsigned int count, bool used)
+{
+    for (unsigned int i = first; i < first + count; i++) {
+        if (used) {
+            hp->used[i / 64] |= 1UL << (i % 64);
+        } else {
+            hp->used[i / 64] &= ~(1UL << (i % 64));
+        }
+    }
+}
+
+/**
+ * Finds the first run of free pages in a hugepage that is at least `count`
+ * pages long, updating the hugepage's longest free run along the way.
+ *
+ * @return index of the first page in the run, or -1 if there is none
+ */
+static int hp_find_run(struct hugepage *hp, unsigned int pages, unsigned int count)
+{
+    int found = -1;
+    unsigned int run = 0, longest = 0;
+    for (unsigned int i = 0; i < pages; i++) {
+        if (hp_page_used(hp, i)) {
+            run = 0;
+            continue;
+        }
+        run++;
+        if (run > longest) {
+            longest = run;
+        }
+        if (found == -1 && count > 0 && run == count) {
+            found = i - count + 1;
+        }
+    }
+    hp->longest_free = longest;
+    return found;
+}
+
+/**
+ * Maps a new 2 MB aligned hugepage for the filler and asks the kernel to
+ * back it with a transparent hugepage.
+ */
+static struct hugepage *hp_grow(unsigned int pages)
+{
+    if (g_num_hugepages == HUGEPAGE_SLOTS) {
+        return NULL;
+    }
+
+    char *base = pages_map(HUGEPAGE_SIZE, HUGEPAGE_SIZE);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    madvise(base, HUGEPAGE_SIZE, MADV_HUGEPAGE);
+
+    struct hugepage *hp = &g_hugepages[g_num_hugepages++];
+    memset(hp, 0, sizeof(struct hugepage));
+    hp->base = base;
+    hp->longest_free = pages;
+    LOG("New hugepage %p\n", base);
+    return hp;
+}
+
+/**
+ * Serves a region of `size` bytes from the hugepage filler. The fullest
+ * hugepage that still has a long enough run of free pages is preferred, so
+ * that partially used hugepages fill up and the emptiest ones drain.
+ *
+ * @return start of the region or NULL if the filler can't serve it
+ */
+static void *hp_alloc(size_t size)
+{
+    size_t page_size = getpagesize();
+    unsigned int pages = HUGEPAGE_SIZE / page_size;
+    unsigned int count = size / page_size;
+    if (pages > HUGEPAGE_MAX_PAGES || count >= pages) {
+        return NULL;
+    }
+
+    struct hugepage *fullest = NULL;
+    for (unsigned int i = 0; i < g_num_hugepages; i++) {
+        struct hugepage *hp = &g_hugepages[i];
+        if (hp->longest_free < count) {
+            continue;
+        }
+        if (fullest == NULL || hp->used_pages > fullest->used_pages) {
+            fullest = hp;
+        }
+    }
+    if (fullest == NULL) {
+        fullest = hp_grow(pages);
+        if (fullest == NULL) {
+            return NULL;
+        }
+    }
+
+    int first = hp_find_run(fullest, pages, count);
+    hp_set_pages(fullest, first, count, true);
+    fullest->used_pages += count;
+    hp_find_run(fullest, pages, 0);
+    g_hugepage_bytes += size;
+    return fullest->base + (size_t) first * page_size;
+}
+
+/**
+ * Returns a region to the filler if it was carved out of one of its
+ * hugepages. Hugepages that become completely empty are unmapped whole.
+ *
+ * @return true if the region belonged to the filler
+ */
+static bool hp_free(void *addr, size_t size)
+{
+    size_t page_size = getpagesize();
+    unsigned int pages = HUGEPAGE_SIZE / page_size;
+    char *base = (char *) ((uintptr_t) addr & ~(HUGEPAGE_SIZE - 1));
+    for (unsigned int i = 0; i < g_num_hugepages; i++) {
+        struct hugepage *hp = &g_hugepages[i];
+        if (hp->base != base) {
+            continue;
+        }
+        unsigned int count = size / page_size;
+        hp_set_pages(hp, ((char *) addr - base) / page_size, count, false);
+        hp->used_pages -= count;
+        g_hugepage_bytes -= size;
+        if (hp->used_pages == 0) {
+            LOG("Releasing hugepage %p\n", hp->base);
+            if (pages_unmap(hp->base, HUGEPAGE_SIZE) == -1) {
+                perror("munmap");
+            }
+            *hp = g_hugepages[--g_num_hugepages];
+        } else {
+            hp_find_run(hp, pages, 0);
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Finds the directory slot for `addr`: the index of the region containing
+ * it, or of the first region above it if none does.
+ */
+static size_t region_slot(const void *addr)
+{
+    size_t lo = 0, hi = g_region_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((const char *) addr >= g_region_dir[mid]->base + g_region_dir[mid]->size) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Looks up the region containing `addr` in O(log regions).
+ *
+ * @return the region's record, or NULL if no region contains it
+ */
+static struct region *region_lookup(const void *addr)
+{
+    size_t slot = region_slot(addr);
+    if (slot < g_region_count && (const char *) addr >= g_region_dir[slot]->base) {
+        return g_region_dir[slot];
+    }
+    return NULL;
+}
+
+/**
+ * Takes a record for a new region, mapping a page of them when none are
+ * spare. Records never move, so list links and pointers held elsewhere stay
+ * valid while the directory shifts its entries.
+ *
+ * @return the record, or NULL if no page could be mapped
+ */
+static struct region *region_record(void)
+{
+    if (g_region_spare == NULL) {
+        size_t page_size = getpagesize();
+        struct region *records = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (records == MAP_FAILED) {
+            perror("mmap");
+            return NULL;
+        }
+        for (size_t i = 0; i < page_size / sizeof(struct region); i++) {
+            records[i].next = g_region_spare;
+            g_region_spare = &records[i];
+        }
+    }
+    struct region *region = g_region_spare;
+    g_region_spare = region->next;
+    return region;
+}
+
+/**
+ * Adds a region to the directory, growing the directory's mapping if needed.
+ * The directory only holds pointers, so an insert moves 8 bytes per region
+ * above the new one and nothing else.
+ *
+ * @return false if the directory couldn't grow
+ */
+static bool region_dir_insert(char *base, size_t size, unsigned long id, enum region_kind kind,
+        size_t headroom)
+{
+    if (g_region_count == g_region_cap) {
+        size_t page_size = getpagesize();
+        size_t old_bytes = g_region_cap * sizeof(struct region *);
+        size_t new_bytes = old_bytes ? old_bytes * 2 : page_size;
+        void *dir = old_bytes
+            ? mremap(g_region_dir, old_bytes, new_bytes, MREMAP_MAYMOVE)
+            : mmap(NULL, new_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (dir == MAP_FAILED) {
+            perror("mmap");
+            return false;
+        }
+        g_region_dir = dir;
+        g_region_cap = new_bytes / sizeof(struct region *);
+    }
+    struct region *region = region_record();
+    if (region == NULL) {
+        return false;
+    }
+
+    /* New regions always go at the end of the list */
+    *region = (struct region) {
+        .base = base, .size = size, .id = id, .kind = kind, .headroom = headroom,
+        .stamp = g_clock, .prev = g_region_last,
+    };
+    if (g_region_last != NULL) {
+        g_region_last->next = region;
+    } else {
+        g_region_first = region;
+    }
+    g_region_last = region;
+
+    size_t slot = region_slot(base);
+    memmove(&g_region_dir[slot + 1], &g_region_dir[slot],
+            (g_region_count - slot) * sizeof(struct region *));
+    g_region_dir[slot] = region;
+    g_region_count++;
+    return true;
+}
+
+static void region_dir_remove(struct region *region)
+{
+    g_heaps[region->owner].held -= region->size;
+    g_heaps[region->owner].in_use -= region->in_use;
+    if (region->index != NULL) {
+        munmap(region->index, region->index_pages * sizeof(struct mem_block *));
+        g_indexed_regions--;
+    }
+    size_t slot = region_slot(region->base);
+    memmove(&g_region_dir[slot], &g_region_dir[slot + 1],
+            (g_region_count - slot - 1) * sizeof(struct region *));
+    g_region_count--;
+
+    if (region->prev != NULL) {
+        region->prev->next = region->next;
+    } else {
+        g_region_first = region->next;
+    }
+    if (region->next != NULL) {
+        region->next->prev = region->prev;
+    } else {
+        g_region_last = region->prev;
+    }
+    region->next = g_region_spare;
+    g_region_spare = region;
+}
+
+/**
+ * Records `block` as the last block of its region. Called wherever the block
+ * at the end of a region changes, so a whole region can be unlinked from the
+ * list without walking it.
+ */
+static void region_set_last(struct mem_block *block)
+{
+    struct region *region = region_lookup(block);
+    if (region != NULL) {
+        region->last = block;
+    }
+}
+
+/**
+ * Repoints the page index of `absorbed`'s region at `into` when a merge folds
+ * `absorbed` into `into`, the block before it. Entries only ever name a block
+ * at or before their page's start and never go down from one page to the
+ * next, so the entries naming `absorbed` all come after it and before the
+ * first entry naming a later block.
+ */
+static void index_merge(struct mem_block *into, struct mem_block *absorbed)
+{
+    if (g_indexed_regions == 0) {
+        return;
+    }
+    struct region *region = region_lookup(absorbed);
+    if (region == NULL || region->index == NULL) {
+        return;
+    }
+    size_t page_size = getpagesize();
+    size_t page = ((char *) absorbed - region->base + page_size - 1) / page_size;
+    for (; page < region->index_pages && region->index[page] <= absorbed; page++) {
+        if (region->index[page] == absorbed) {
+            region->index[page] = into;
+        }
+    }
+}
+
+/**
+ * Tells whether `block` is the last block of its region.
+ */
+static bool block_is_last(const struct mem_block *block)
+{
+    return block->next == NULL || block->next->region_id != block->region_id;
+}
+
+/**
+ * Maps a plain region followed by REGION_HEADROOM bytes of reserved,
+ * inaccessible address space. The kernel places new mappings top-down, so
+ * without the reservation the space after a region is almost always taken by
+ * the previous one and the region could never grow in place.
+ *
+ * @return start of the region or MAP_FAILED
+ */
+static void *region_reserve(size_t size)
+{
+    char *base = mmap(NULL, size + REGION_HEADROOM, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    if (mprotect(base, size, PROT_READ | PROT_WRITE) == -1) {
+        munmap(base, size + REGION_HEADROOM);
+        return MAP_FAILED;
+    }
+    return base;
+}
+
+/**
+ * Maps `size` bytes of a new, already unlinked file in the overflow
+ * directory. The mapping is shared, so under memory pressure the kernel
+ * writes its pages back to the file instead of needing RAM or swap for them.
+ *
+ * @return start of the mapping or MAP_FAILED
+ */
+static void *file_map(size_t size)
+{
+    char path[sizeof(g_config.overflow_dir) + 32];
+    snprintf(path, sizeof(path), "%s/allocator-overflow-XXXXXX", g_config.overflow_dir);
+    int fd = mkostemp(path, O_CLOEXEC);
+    if (fd == -1) {
+        perror("mkstemp");
+        return MAP_FAILED;
+    }
+    unlink(path);
+
+    void *region = MAP_FAILED;
+    if (ftruncate(fd, size) == -1) {
+        perror("ftruncate");
+    } else {
+        region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    return region;
+}
+
+/**
+ * Decides whether a new region of `size` bytes goes to the overflow tier:
+ * it must be large enough, and the anonymous regions already mapped plus
+ * this one must exceed the budget.
+ */
+static bool overflow_wanted(size_t size)
+{
+    return g_config.overflow_budget != 0 && size >= g_config.overflow_threshold
+        && g_mapped_bytes - g_file_bytes + size > g_config.overflow_budget;
+}
+
+/**
+ * Maps a new region of `size` bytes (a multiple of the page size) and adds
+ * it to the region directory. Large regions past the overflow budget are
+ * file-backed. With the hugepage-aware backend enabled, regions smaller than
+ * a hugepage are packed into filler hugepages; everything else comes from
+ * region_reserve(), or from pages_map() when a page provider or
+ * deterministic mode decides where pages go.
+ *
+ * @param size size of the region
+ * @param id region_id its blocks will carry
+ *
+ * @return start of the region or MAP_FAILED
+ */
+static void *region_map(size_t size, unsigned long id)
+{
+    void *region = NULL;
+    enum region_kind kind = REGION_FILLER;
+    size_t headroom = 0;
+    bool hugepages = g_config.hugepages;
+    if (overflow_wanted(size)) {
+        region = file_map(size);
+        if (region == MAP_FAILED) {
+            /* No room on disk either; try for RAM as usual */
+            region = NULL;
+        } else {
+            kind = REGION_FILE;
+            LOG("Overflow region; size = %zu\n", size);
+        }
+    }
+    if (region == NULL && hugepages) {
+        region = hp_alloc(size);
+    }
+    if (region == NULL && g_page_map == NULL && !g_config.deterministic) {
+        region = region_reserve(size);
+        if (region == MAP_FAILED) {
+            return MAP_FAILED;
+        }
+        kind = REGION_MMAP;
+        headroom = REGION_HEADROOM;
+    }
+    if (region == NULL) {
+        region = pages_map(size, getpagesize());
+        if (region == MAP_FAILED) {
+            return MAP_FAILED;
+        }
+        kind = g_page_map != NULL ? REGION_PROVIDED
+            : det_contains(region) ? REGION_RESERVED : REGION_MMAP;
+    }
+    if (hugepages && kind != REGION_FILLER && kind != REGION_FILE && size >= HUGEPAGE_SIZE) {
+        madvise(region, size, MADV_HUGEPAGE);
+    }
+    if (!region_dir_insert(region, size, id, kind, headroom)) {
+        if (kind == REGION_FILLER) {
+            hp_free(region, size);
+        } else if (kind == REGION_FILE) {
+            munmap(region, size);
+        } else {
+            pages_unmap(region, size + headroom);
+        }
+        return MAP_FAILED;
+    }
+    g_mapped_bytes += size;
+    if (kind == REGION_FILE) {
+        g_file_regions++;
+        g_file_bytes += size;
+    }
+    return region;
+}
+
+/**
+ * Hands out the static bootstrap arena as a region if it is free and big
+ * enough, so the first allocations need no mapping. When the region empties
+ * out the arena becomes available again. Deterministic mode and page
+ * providers decide where every region goes, so they never get it.
+ *
+ * @param size requested region size; set to the arena's size on success
+ * @param id region_id its blocks will carry
+ *
+ * @return the arena, or NULL
+ */
+static void *bootstrap_map(size_t *size, unsigned long id)
+{
+#if ALLOCATOR_BOOTSTRAP_SIZE > 0
+    if (g_bootstrap_in_use || *size > sizeof(g_bootstrap)
+            || g_page_map != NULL || g_config.deterministic) {
+        return NULL;
+    }
+    if (!region_dir_insert(g_bootstrap, sizeof(g_bootstrap), id, REGION_BOOTSTRAP, 0)) {
+        return NULL;
+    }
+    g_bootstrap_in_use = true;
+    *size = sizeof(g_bootstrap);
+    g_mapped_bytes += *size;
+    return g_bootstrap;
+#else
+    (void) size;
+    (void) id;
+    return NULL;
+#endif
+}
+
+/**
+ * Releases a region previously returned by region_map() or bootstrap_map(),
+ * along with any headroom still reserved after it.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int region_unmap(void *region, size_t size)
+{
+    struct region *entry = region_lookup(region);
+    bool file = false;
+#if ALLOCATOR_BOOTSTRAP_SIZE > 0
+    if (entry != NULL && entry->kind == REGION_BOOTSTRAP) {
+        g_mapped_bytes -= entry->size;
+        region_dir_remove(entry);
+        g_bootstrap_in_use = false;
+        return 0;
+    }
+#endif
+    if (entry != NULL) {
+        size += entry->headroom;
+        g_mapped_bytes -= entry->size;
+        if (entry->kind == REGION_FILE) {
+            file = true;
+            g_file_regions--;
+            g_file_bytes -= entry->size;
+        }
+        region_dir_remove(entry);
+    }
+    if (file) {
+        return munmap(region, size);
+    }
+    if (hp_free(region, size)) {
+        return 0;
+    }
+    return pages_unmap(region, size);
+}
+
+/**
+ * Returns the calling thread's small id, assigning one on first use. Must be
+ * called with the allocator lock held.
+ */
+static unsigned int thread_id(void)
+{
+    if (t_thread_id == 0) {
+        t_thread_id = ++g_threads;
+    }
+    return t_thread_id;
+}
+
+static void trace_flush(void)
+{
+    size_t written = 0;
+    while (written < g_trace_len) {
+        ssize_t n = write(g_trace_fd, g_trace_buf + written, g_trace_len - written);
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    g_trace_len = 0;
+}
+
+/**
+ * Appends an operation to the allocation trace. Lines have the form
+ *
+ *   a <thread> <time ns> <id> <size>
+ *   f <thread> <time ns> <id>
+ *
+ * where the id is the allocation's address. Must be called with the
+ * allocator lock held so lines appear in the order operations happened.
+ */
+static void trace_record(char op, void *ptr, size_t size)
+{
+    if (g_trace_len + 96 > sizeof(g_trace_buf)) {
+        trace_flush();
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ns = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    char *line = g_trace_buf + g_trace_len;
+    size_t room = sizeof(g_trace_buf) - g_trace_len;
+    int len;
+    if (op == 'a') {
+        len = snprintf(line, room, "a %u %lu %lx %zu\n", thread_id(), ns, (uintptr_t) ptr, size);
+    } else {
+        len = snprintf(line, room, "f %u %lu %lx\n", thread_id(), ns, (uintptr_t) ptr);
+    }
+    g_trace_len += len;
+}
+
+/**
+ * Flushes the allocation trace when the process exits.
+ */
+__attribute__((destructor)) static void trace_finish(void)
+{
+    pthread_mutex_lock(&alloc_mutex);
+    if (g_trace_fd != -1) {
+        trace_flush();
+    }
+    pthread_mutex_unlock(&alloc_mutex);
+}
+
+/**
+ * Given a free block, this function will split it into two pieces and update
+ * the linked list.
+ *
+ * @param block the block to split
+ * @param size new size of the first block after the split is complete,
+ * including header sizes. The size of the second block will be the original
+ * block's size minus this parameter.
+ *
+ * @return address of the resulting second block (the original address will be
+ * unchanged) or NULL if the block cannot be split.
+ */
+struct mem_block *ca_split_block(struct mem_block *block, size_t size)
+{   
+    size_t min_sz = sizeof(struct mem_block) + BLOCK_ALIGN;
+
+    if(size < min_sz){
+        return NULL;
+    }
+    if(block->free == false){
+        return NULL;
+    }
+    size_t rm_sz = block->size - size;
+    if(rm_sz < 104){
+        return NULL;
+    }
+    
+    struct mem_block *new_block = (void *) block + size;
+    bool was_last = block_is_last(block);
+    LOG("Splitting block: %p\n", new_block);
+    if(block == g_tail){
+        block->next = new_block;
+        new_block->prev = block;
+        new_block->next = NULL;
+        g_tail = new_block;
+    }
+    else{
+        new_block->next = block->next;
+        block->next->prev = new_block;
+        new_block->prev = block;
+        block->next = new_block;
+    }
+
+    snprintf(new_block->name, 32, "Split block %lu", g_splits++);
+    new_block->size = rm_sz;
+    new_block->free = true;
+    new_block->region_id = block->region_id;
+    new_block->flags = 0;
+    new_block->site = 0;
+    new_block->tag = block->tag;
+    new_block->heap = block->heap;
+    block->size = size;
+    if (was_last) {
+        region_set_last(new_block);
+    }
+    LOG("returning from split_block: %p\n", new_block);
+    return new_block;
+}
+
+/**
+ * Given a free block, this function attempts to merge it with neighboring
+ * blocks --- both the previous and next neighbors --- and update the linked
+ * list accordingly.
+ *
+ * @param block the block to merge
+ *
+ * @return address of the merged block or NULL if the block cannot be merged.
+ */
+struct mem_block *ca_merge_block(struct mem_block *block)
+{
+
+    if(block->next != NULL){
+        if(block->next->free == true && block->next->region_id == block->region_id){//if next and block are in same region
+            // LOG("2 blocks down (block->next->next): %p\n", block->next->next);
+            bool next_was_last = block_is_last(block->next);
+            index_merge(block, block->next);
+            block->size = block->size + block->next->size;
+            // LOG("merging block->next + block = %zu\n", block->size);
+            // LOG("merge block: %p\n", block);
+            if(block->next == g_tail){
+                g_tail = block;
+                block->next->prev = NULL;
+                block->next = NULL;
+            }
+            else{
+                // LOG("before pointing to block->next->next...: %p\n", block->next);
+                block->next = block->next->next;
+                block->next->prev = block;
+                // LOG("after: block->next: %p\n", block->next);
+            }
+            if (next_was_last) {
+                region_set_last(block);
+            }
+        }
+    }
+    if(block->prev != NULL){
+        if(block->prev->free == true && block->prev->region_id == block->region_id){//if prev and block are in same region
+            // LOG("2 blocks down from previous block(block->next): %p\n", block->next);
+            struct mem_block *prev = block->prev;
+            bool was_last = block_is_last(block);
+            index_merge(prev, block);
+            prev->size = prev->size + block->size;
+            // LOG("merging block prev + block = %zu\n", prev->size);
+            if(block == g_tail){
+                g_tail = prev;
+                prev->next = NULL;
+                block->prev = NULL;
+            }
+            else{
+                // LOG("before pointing to prev block to block->next...: %p\n", prev->next);
+                prev->next = block->next;
+                prev->next->prev = prev;
+                // LOG("after: prev->next: %p\n", prev->next);
+            }
+            if (was_last) {
+                region_set_last(prev);
+            }
+            block = prev; /* continue with the merged block so an emptied region is released */
+        }
+    }
+    if(block == g_head && block == g_tail){//if it was only block in memory unmap
+        g_head = NULL;
+        g_tail = NULL;
+        if(region_unmap(block, block->size) == -1){
+            perror("munmap");
+            return NULL;
+        }
+    }
+    else if((block->next != NULL && block->next->region_id != block->region_id) && (block->prev != NULL && block->prev->region_id != block->region_id)){//prev & next are in diff regions
+        block->prev->next = block->next;
+        block->next->prev = block->prev;
+        if(region_unmap(block, block->size) == -1){
+            perror("munmap");
+            return NULL;
+        }
+    }
+    else if(block->prev != NULL && block == g_tail && block->prev->region_id != block->region_id){//if block is tail and only block in region
+        g_tail = block->prev;
+        block->prev->next = NULL;
+        block->prev = NULL;
+        if(region_unmap(block, block->size) == -1){
+            perror("munmap");
+            return NULL;
+        }
+    }
+    else if(block->next != NULL && block == g_head && block->next->region_id != block->region_id){//if block is head and only block in region
+        g_head = block->next;
+        block->next->prev = NULL;
+        block->next = NULL;
+        if(region_unmap(block, block->size) == -1){
+            perror("munmap");
+            return NULL;
+        }
+    }
+    return block;
+}
+
+/**
+ * Lets the engines pass over whole regions. When `block` is the first block
+ * of a region whose free bytes add up to less than `size`, or that belongs to
+ * another tag or heap, none of its blocks can be picked, so the walk resumes
+ * at the next region. The engines still pick exactly the block they would
+ * have found walking every block. Regions are followed through the
+ * regions' list order links, so skipped regions' headers are never read.
+ *
+ * @return the next block the engine has to look at
+ */
+static struct mem_block *fit_skip(struct mem_block *block, size_t size)
+{
+    while (g_fit_next != NULL && (char *) block == g_fit_next->base) {
+        struct region *region = g_fit_next;
+        size_t free_bytes = region->size - region->in_use;
+        g_fit_next = region->next;
+        if (free_bytes > g_fit_seen) {
+            g_fit_seen = free_bytes;
+        }
+        if (free_bytes >= size && region->tag == t_tag && region->owner == t_heap) {
+            break;
+        }
+        block = g_fit_next != NULL ? (struct mem_block *) g_fit_next->base : NULL;
+    }
+    return block;
+}
+
+/**
+ * Starts an engine walk. No free block is larger than its region's free
+ * bytes, so a request above g_fit_bound can't fit anywhere and fails without
+ * a walk. That is the common case while the heap grows.
+ *
+ * @return the first block the engine has to look at, or NULL
+ */
+static struct mem_block *fit_start(size_t size)
+{
+    if (size > g_fit_bound) {
+        g_fit_seen = g_fit_bound;
+        return NULL;
+    }
+    g_fit_seen = 0;
+    g_fit_next = g_region_first;
+    return fit_skip(g_head, size);
+}
+
+/**
+ * Ends an engine walk that went through the whole list: fit_skip looked up
+ * every region on the way, so the bound becomes exact again. After a walk
+ * fit_start cut short, the bound stays as it was.
+ */
+static void fit_done(void)
+{
+    g_fit_bound = g_fit_seen;
+}
+
+/**
+ * Keeps g_fit_bound above the free bytes of `region`, which just changed.
+ */
+static void fit_bound_raise(const struct region *region)
+{
+    if (region->size - region->in_use > g_fit_bound) {
+        g_fit_bound = region->size - region->in_use;
+    }
+}
+
+/**
+ * Given a block size (header + data), locate a suitable location using the
+ * first fit free space management algorithm.
+ *
+ * @param size size of the block (header + data)
+ */
+void *ca_first_fit(size_t size)
+{
+    struct mem_block *current = fit_start(size);
+    while(current != NULL){
+        if(size <= current->size && current->free == true
+                && current->tag == t_tag && current->heap == t_heap){
+            LOG("First fit: current name = %s\n", current->name);
+            return current;
+        }
+        // LOG("First fit: current name = %s\n", current->name);
+        // LOG("First fit: current is free = %d\n", current->free);
+        // LOG("First fit: current size = %zu\n", current->size);
+        current = fit_skip(current->next, size);
+    }
+    fit_done();
+    return NULL;
+}
+
+/**
+ * Given a block size (header + data), locate a suitable location using the
+ * worst fit free space management algorithm. If there are ties (i.e., you find
+ * multiple worst fit candidates with the same size), use the first candidate
+ * found.
+ *
+ * @param size size of the block (header + data)
+ */
+void *ca_worst_fit(size_t size)
+{
+    struct mem_block *current = fit_start(size);
+    struct mem_block *worst = NULL;
+    ssize_t worst_size = INT_MIN;
+    while(current != NULL){
+        if(size <= current->size && current->free == true
+                && current->tag == t_tag && current->heap == t_heap){
+            ssize_t diff = (ssize_t) current->size - size;
+            if(diff > worst_size){
+                worst = current;
+                worst_size = diff;
+            }
+        }
+        /* Only a strictly larger block can replace the worst one so far */
+        current = fit_skip(current->next, worst != NULL ? worst->size + 1 : size);
+    }
+    fit_done();
+    return worst;
+}
+
+/**
+ * Given a block size (header + data), locate a suitable location using the
+ * best fit free space management algorithm. If there are ties (i.e., you find
+ * multiple best fit candidates with the same size), use the first candidate
+ * found.
+ *
+ * @param size size of the block (header + data)
+ */
+void *ca_best_fit(size_t size)
+{
+    struct mem_block *current = fit_start(size);
+    struct mem_block *best = NULL;
+    size_t best_size = INT_MAX;
+    while(current != NULL){
+        if(size <= current->size && current->free == true
+                && current->tag == t_tag && current->heap == t_heap){
+            ssize_t diff = (ssize_t) current->size - size;
+            if(diff < best_size){
+                best = current;
+                best_size = diff;
+            }
+        }
+        current = fit_skip(current->next, size);
+    }
+    fit_done();
+    return best;
+}
+
+/**
+ * Finds the route for a block with `usable` bytes after its header. Must only
+ * be called when routes are configured; the last route catches everything.
+ */
+static const struct route *route_for(size_t usable)
+{
+    const struct route *route = g_config.routes;
+    while (usable > route->usable_limit) {
+        route++;
+    }
+    return route;
+}
+
+void *ca_reuse(size_t size)
+{
+    void *reused_block = NULL;
+
+#ifdef ALLOCATOR_ENGINE
+    /* Specialized build: the engine is fixed at compile time, but an mmap
+     * route still never reuses a block */
+    if (g_config.num_routes == 0 || !route_for(size - sizeof(struct mem_block))->direct) {
+        reused_block = ENGINE_FN(ALLOCATOR_ENGINE)(size);
+    }
+#else
+    void *(*fit)(size_t size) = g_config.engine;
+    if (g_config.num_routes > 0) {
+        const struct route *route = route_for(size - sizeof(struct mem_block));
+        if (route->direct) {
+            fit = NULL;
+        } else if (route->fit != NULL) {
+            fit = route->fit;
+        }
+    }
+    if (fit != NULL) {
+        reused_block = fit(size);
+    }
+#endif
+
+    if(reused_block != NULL){
+        ca_split_block(reused_block, size);      
+    }
+    return reused_block;
+}
+
+/**
+ * Looks for a free block of at least `size` bytes close to `origin`, walking
+ * outward from it one block at a time, nearest side first, without leaving
+ * its region. The first fit found is the closest, so a block on the same
+ * page wins whenever there is one.
+ *
+ * @param origin block to search around; it is a candidate itself
+ * @param size size of the block (header + data)
+ *
+ * @return the block, already split to size, or NULL if none is close enough
+ */
+static struct mem_block *fit_around(struct mem_block *origin, size_t size)
+{
+    if (origin->tag != t_tag || origin->heap != t_heap) {
+        return NULL;
+    }
+    if (origin->free && origin->size >= size) {
+        ca_split_block(origin, size);
+        return origin;
+    }
+
+    struct mem_block *before = origin->prev;
+    struct mem_block *after = origin->next;
+    for (unsigned int i = 0; i < 2 * NEAR_SCAN_BLOCKS; i++) {
+        if (before != NULL && before->region_id != origin->region_id) {
+            before = NULL;
+        }
+        if (after != NULL && after->region_id != origin->region_id) {
+            after = NULL;
+        }
+
+        struct mem_block *candidate;
+        if (before == NULL && after == NULL) {
+            break;
+        } else if (after == NULL
+                || (before != NULL && (char *) origin - (char *) before < (char *) after - (char *) origin)) {
+            candidate = before;
+            before = before->prev;
+        } else {
+            candidate = after;
+            after = after->next;
+        }
+
+        if (candidate->free && candidate->size >= size) {
+            ca_split_block(candidate, size);
+            return candidate;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Brings a region's page index up to date. Splits only add headers, so an
+ * entry stays a block at or before its page's start, and merges repoint the
+ * entries of the blocks they remove (index_merge). The index is only built
+ * on first use and rebuilt when the region has grown.
+ *
+ * @return false if there is no memory for the index
+ */
+static bool region_index(struct region *region)
+{
+    size_t page_size = getpagesize();
+    size_t pages = (region->size + page_size - 1) / page_size;
+    if (region->index != NULL && region->index_pages == pages) {
+        return true;
+    }
+    if (region->index != NULL) {
+        munmap(region->index, region->index_pages * sizeof(struct mem_block *));
+        region->index = NULL;
+        g_indexed_regions--;
+    }
+    void *index = mmap(NULL, pages * sizeof(struct mem_block *), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (index == MAP_FAILED) {
+        return false;
+    }
+    region->index = index;
+    region->index_pages = pages;
+    g_indexed_regions++;
+
+    size_t page = 0;
+    for (struct mem_block *block = (struct mem_block *) region->base; ; block = block->next) {
+        size_t end = (char *) block + block->size - region->base;
+        for (; page < pages && page * page_size < end; page++) {
+            region->index[page] = block;
+        }
+        if (block == region->last) {
+            break;
+        }
+    }
+    return true;
+}
+
+/**
+ * Finds the block of `region` whose header or data area holds `ptr`, starting
+ * from the region's page index.
+ *
+ * @return the block, or NULL if there is no memory for the index
+ */
+static struct mem_block *region_block_at(struct region *region, const void *ptr)
+{
+    if (!region_index(region)) {
+        return NULL;
+    }
+    struct mem_block *block = region->index[((char *) ptr - region->base) / getpagesize()];
+    while (block != region->last && (const char *) block->next <= (const char *) ptr) {
+        block = block->next;
+    }
+    return block;
+}
+
+/**
+ * Places a malloc_near allocation next to the allocated block at `hint`.
+ * Hints that are not the start of a live allocation are ignored.
+ *
+ * @return the block, already split to size, or NULL
+ */
+static struct mem_block *near_fit(const void *hint, size_t size)
+{
+    struct region *region = region_lookup(hint);
+    if (region == NULL || region->live == 0) {
+        return NULL;
+    }
+    struct mem_block *origin = region_block_at(region, hint);
+    if (origin == NULL || origin->free || (const void *) (origin + 1) != hint) {
+        return NULL;
+    }
+    g_near_requests++;
+
+    struct mem_block *block = fit_around(origin, size);
+    if (block != NULL) {
+        g_near_hits++;
+    }
+    return block;
+}
+
+/**
+ * Places an allocation in the region the calling thread last freed into,
+ * around the block most recently freed there, as long as the region has been
+ * used recently enough to still be warm in cache and TLB.
+ *
+ * @return the block, already split to size, or NULL
+ */
+static struct mem_block *warm_fit(size_t size)
+{
+    if (t_warm_base == NULL) {
+        return NULL;
+    }
+    struct region *region = region_lookup(t_warm_base);
+    if (region == NULL || region->warm == NULL || g_clock - region->stamp > WARM_WINDOW) {
+        return NULL;
+    }
+
+    struct mem_block *block = fit_around(region->warm, size);
+    if (block != NULL) {
+        g_warm_hits++;
+    }
+    return block;
+}
+
+/**
+ * Records that a block in the region containing `block` was just used.
+ *
+ * @return the region, or NULL if the block's region is gone
+ */
+static struct region *region_touch(struct mem_block *block)
+{
+    struct region *region = region_lookup(block);
+    if (region != NULL) {
+        region->stamp = ++g_clock;
+    }
+    return region;
+}
+
+/**
+ * Hands a region, with everything allocated in it, to another heap (0 for
+ * the global pool). Its blocks are restamped so the engines of the new
+ * owner's thread see them.
+ */
+static void region_give(struct region *region, uint16_t heap)
+{
+    g_heaps[region->owner].held -= region->size;
+    g_heaps[region->owner].in_use -= region->in_use;
+    g_heaps[heap].held += region->size;
+    g_heaps[heap].in_use += region->in_use;
+    region->owner = heap;
+    for (struct mem_block *block = (struct mem_block *) region->base; ; block = block->next) {
+        block->heap = heap;
+        if (block == region->last) {
+            break;
+        }
+    }
+}
+
+/**
+ * Restores Hoard's emptiness invariant after a free into `region`. A thread
+ * heap may hold at most HEAP_SLACK unused bytes or `emptiness` percent of
+ * what it holds, whichever is more. Past that, the region is given up to the
+ * global pool if it is at least that empty itself, so memory freed by one
+ * thread's workload can be reused by another's instead of piling up.
+ */
+static void heap_balance(struct region *region)
+{
+    uint16_t owner = region->owner;
+    size_t held = g_heaps[owner].held;
+    size_t in_use = g_heaps[owner].in_use;
+    size_t full = 100 - g_config.emptiness;
+    if (owner == 0 || held - in_use <= HEAP_SLACK || in_use * 100 >= held * full
+            || region->in_use * 100 > region->size * full) {
+        return;
+    }
+    LOG("Heap %u gives region %lu to the global pool\n", owner, region->id);
+    region_give(region, 0);
+    g_heap_releases++;
+}
+
+/**
+ * Takes over the first region in the global pool with a free block of
+ * `size` bytes for the calling thread's heap.
+ *
+ * @return that block, already split to size, or NULL
+ */
+static struct mem_block *heap_adopt(size_t size)
+{
+    for (size_t i = 0; i < g_region_count; i++) {
+        struct region *region = g_region_dir[i];
+        if (region->owner != 0 || region->tag != t_tag || region->size - region->in_use < size) {
+            continue;
+        }
+        for (struct mem_block *block = (struct mem_block *) region->base; ; block = block->next) {
+            if (block->free && block->size >= size) {
+                LOG("Heap %u adopts region %lu\n", t_heap, region->id);
+                region_give(region, t_heap);
+                g_heap_adoptions++;
+                ca_split_block(block, size);
+                return block;
+            }
+            if (block == region->last) {
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void *alloc_block(size_t size, size_t aligned_size, const void *hint);
+
+/**
+ * Adds a block that is being freed to the lifetime histograms. Two bit scans
+ * and an increment, so it is cheap enough to do on every free.
+ */
+static void lifetime_record(const struct mem_block *block)
+{
+    uint64_t lifetime = g_alloc_clock - block->birth;
+    unsigned int bucket = lifetime == 0 ? 0 : 64 - __builtin_clzll(lifetime);
+    if (bucket >= CA_LIFETIME_BUCKETS) {
+        bucket = CA_LIFETIME_BUCKETS - 1;
+    }
+
+    /* Classes are powers of 4 starting at 64 bytes */
+    size_t usable = block->size - sizeof(struct mem_block);
+    unsigned int bits = usable <= 1 ? 0 : 64 - __builtin_clzll(usable - 1);
+    unsigned int class = bits <= 6 ? 0 : (bits - 5) / 2;
+    if (class >= CA_LIFETIME_CLASSES) {
+        class = CA_LIFETIME_CLASSES - 1;
+    }
+    g_lifetimes[class][bucket]++;
+}
+
+/**
+ * Records the call site an allocation was requested from, if it was picked
+ * for sampling.
+ *
+ * @return alloc
+ */
+static void *site_record(void *alloc, void *site)
+{
+    if (alloc != NULL) {
+        struct mem_block *block = (struct mem_block *) alloc - 1;
+        if (block->flags & BLOCK_SAMPLED) {
+            block->site = (uintptr_t) site;
+        }
+    }
+    return alloc;
+}
+
+/**
+ * Allocates `size` bytes, near `hint` if it is not NULL, and records the
+ * call site if the allocation is sampled.
+ */
+static void *alloc_sampled(size_t size, const void *hint, void *site)
+{
+    size_t aligned_size = ca_block_size(size);
+    if (aligned_size == 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return site_record(alloc_block(size, aligned_size, hint), site);
+}
+
+void *ca_malloc_name(size_t size, char *name){
+    void *alloc = alloc_sampled(size, NULL, __builtin_return_address(0));
+    if(alloc == NULL){
+        return NULL;
+    }
+    struct mem_block *new_block = (struct mem_block *) alloc - 1;
+    strcpy(new_block->name, name);
+    new_block->flags |= BLOCK_NAMED;
+    LOG("Created name block: %s\n", name);
+    return alloc;
+}
+
+void *malloc_near(const void *hint, size_t size)
+{
+    return alloc_sampled(size, hint, __builtin_return_address(0));
+}
+
+/* The count ends the header, so it sits right before the data */
+static uint32_t *rc_count(void *ptr)
+{
+    return (uint32_t *) ptr - 1;
+}
+
+void *rc_alloc(size_t size)
+{
+    void *ptr = alloc_sampled(size, NULL, __builtin_return_address(0));
+    if (ptr != NULL) {
+        __atomic_store_n(rc_count(ptr), 1, __ATOMIC_RELAXED);
+    }
+    return ptr;
+}
+
+void *rc_retain(void *ptr)
+{
+    /* Taking a new reference needs no ordering: the caller already holds one */
+    __atomic_fetch_add(rc_count(ptr), 1, __ATOMIC_RELAXED);
+    return ptr;
+}
+
+uint32_t rc_release(void *ptr)
+{
+    if (ptr == NULL) {
+        return 0;
     }
-    struct mem_block *new_block = (struct mem_block *) alloc - 1;
-    strcpy(new_block->name, name);
-    LOG("Created name block: %s\n", name);
-    return alloc;
+    /* Release so our writes are visible to whoever frees; acquire so the
+     * freeing thread sees everyone else's before the memory is reused */
+    uint32_t left = __atomic_sub_fetch(rc_count(ptr), 1, __ATOMIC_ACQ_REL);
+    if (left == 0) {
+        ca_free_block((struct mem_block *) ptr - 1);
+    }
+    return left;
+}
+
+/**
+ * Maps a new region big enough for a block of `aligned_size` bytes, appends
+ * it to the end of the list and splits off the unused remainder.
+ *
+ * @return the block at the start of the region, or NULL if mapping failed
+ */
+static struct mem_block *region_new(size_t aligned_size)
+{
+    int page_size = getpagesize();
+    size_t num_pages = aligned_size / page_size;
+    if (aligned_size % page_size != 0){
+        num_pages++;
+    }
+
+    size_t region_size = num_pages * page_size;
+    LOG("New region; size = %zu\n", region_size);
+    
+    struct mem_block *new_block = bootstrap_map(&region_size, g_regions);
+    if (new_block == NULL) {
+        new_block = region_map(region_size, g_regions);
+    }
+    
+    if (new_block == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    snprintf(new_block->name, 32, "Allocation %lu", g_allocations++);
+    new_block->region_id = g_regions++;
+    new_block->tag = t_tag;
+    new_block->heap = t_heap;
+    struct region *region = region_lookup(new_block);
+    region->last = new_block;
+    region->tag = t_tag;
+    region->owner = t_heap;
+    g_heaps[t_heap].held += region->size;
+
+    /* Only the region at the end of the list grows, so the old one's
+     * headroom can go */
+    struct region *old_tail = g_tail != NULL ? region_lookup(g_tail) : NULL;
+    if (old_tail != NULL && old_tail->headroom > 0) {
+        munmap(old_tail->base + old_tail->size, old_tail->headroom);
+        old_tail->headroom = 0;
+    }
+
+    if(g_head == NULL && g_tail == NULL){
+        g_head = new_block;
+        g_tail = g_head;
+        new_block->prev = NULL;
+    }
+    else{
+        g_tail->next = new_block;
+        new_block->prev = g_tail;
+        g_tail = new_block;
+    }
+
+    new_block->free = true;
+    new_block->size = region_size;
+    new_block->next = NULL;
+    ca_split_block(new_block, aligned_size);
+    LOG("New allocation %p (data = %p)\n", new_block, new_block + 1);
+    return new_block;
+}
+
+/**
+ * Tries to make room for a block of `aligned_size` bytes by growing the
+ * region at the end of the list in place, extending its free tail block. The
+ * region first grows into its reserved headroom; past that, mremap without
+ * MREMAP_MAYMOVE is tried. Growing instead of mapping a new region keeps the
+ * heap contiguous, so the new space can coalesce with the old.
+ *
+ * @return the extended tail block, already split to size, or NULL if the
+ * region couldn't grow in place
+ */
+static struct mem_block *region_extend(size_t aligned_size)
+{
+    if (g_tail == NULL || !g_tail->free || g_tail->size >= aligned_size) {
+        return NULL;
+    }
+    struct region *region = region_lookup(g_tail);
+    bool provided = region != NULL && region->kind == REGION_PROVIDED && g_page_grow != NULL;
+    if (region == NULL || (region->kind != REGION_MMAP && !provided)
+            || region->tag != t_tag || region->owner != t_heap
+            || (char *) g_tail + g_tail->size != region->base + region->size) {
+        return NULL;
+    }
+
+    size_t page_size = getpagesize();
+    size_t grow = (aligned_size - g_tail->size + page_size - 1) & ~(page_size - 1);
+    char *end = region->base + region->size;
+    g_extend_attempts++;
+    if (provided) {
+        if (g_page_grow(region->base, region->size, region->size + grow) == -1) {
+            return NULL;
+        }
+    } else if (region->headroom >= grow) {
+        if (mprotect(end, grow, PROT_READ | PROT_WRITE) == -1) {
+            return NULL;
+        }
+        region->headroom -= grow;
+    } else {
+        /* Out of headroom: give it back and see if the kernel lets us grow */
+        if (region->headroom > 0) {
+            munmap(end, region->headroom);
+            region->headroom = 0;
+        }
+        if (mremap(region->base, region->size, region->size + grow, 0) == MAP_FAILED) {
+            return NULL;
+        }
+    }
+    g_extend_successes++;
+    LOG("Extended region %lu in place by %zu bytes\n", region->id, grow);
+
+    struct mem_block *block = g_tail;
+    region->size += grow;
+    g_heaps[region->owner].held += grow;
+    g_mapped_bytes += grow;
+    block->size += grow;
+    ca_split_block(block, aligned_size);
+    return block;
+}
+
+/**
+ * Allocates a block of `aligned_size` bytes: near `hint` when one is given,
+ * else from the placement engine, else by growing or mapping a region.
+ */
+static void *alloc_block(size_t size, size_t aligned_size, const void *hint)
+{
+    if (g_report_pending) {
+        report_pending();
+    }
+    pthread_mutex_lock(&alloc_mutex);
+    LOG("allocation request; size = %zu, aligned = %zu\n", size, aligned_size);
+    if (!g_config.loaded) {
+        config_load();
+    }
+    if (g_config.heaps && t_heap == 0) {
+        t_heap = 1 + (thread_id() - 1) % HEAPS_MAX;
+    }
+    unsigned char flags = 0;
+    if (g_config.sample_interval != 0 && g_sample_countdown-- == 0) {
+        flags = BLOCK_SAMPLED;
+        g_sample_countdown = g_config.sample_interval - 1;
+    }
+
+    const struct route *route = NULL;
+    if (g_config.num_routes > 0) {
+        route = route_for(aligned_size - sizeof(struct mem_block));
+    }
+    bool direct = route != NULL && route->direct;
+
+    struct mem_block *block = NULL;
+    if (hint != NULL && !direct) {
+        block = near_fit(hint, aligned_size);
+    }
+    if (block == NULL && g_config.warm && !direct) {
+        block = warm_fit(aligned_size);
+    }
+    if (block == NULL) {
+        block = ca_reuse(aligned_size);
+    }
+    if (block == NULL && g_config.heaps && !direct) {
+        block = heap_adopt(aligned_size);
+    }
+    if (block == NULL && !direct) {
+        block = region_extend(aligned_size);
+    }
+    if (block == NULL) {
+        block = region_new(aligned_size);
+        if (block == NULL) {
+            pthread_mutex_unlock(&alloc_mutex);
+            return NULL;
+        }
+    }
+
+    struct region *region = region_lookup(block);
+    if (region != NULL) {
+        region->live++;
+        region->in_use += block->size;
+        fit_bound_raise(region);
+        g_heaps[region->owner].in_use += block->size;
+        if (g_config.warm) {
+            region->stamp = ++g_clock;
+        }
+    }
+    block->free = false;
+    block->flags = flags;
+    block->site = 0;
+    block->birth = g_alloc_clock++;
+    if (t_tag != 0) {
+        strcpy(block->name, g_tags[t_tag - 1]);
+        block->flags |= BLOCK_NAMED;
+    }
+    t_allocated += block->size - sizeof(struct mem_block);
+    if (route != NULL) {
+        /* Counted by the block's final size, which is what the free sees */
+        size_t index = route_for(block->size - sizeof(struct mem_block)) - g_config.routes;
+        g_route_stats[index].allocations++;
+        g_route_stats[index].live_bytes += block->size - sizeof(struct mem_block);
+    }
+#if ALLOCATOR_SCRIBBLE_SUPPORT
+    if (g_config.scribble) {
+        memset(block + 1, 0xAA, size);
+    }
+#endif
+    if (g_trace_fd != -1) {
+        trace_record('a', block + 1, size);
+    }
+    pthread_mutex_unlock(&alloc_mutex);
+    return block + 1;
+}
+
+void *ca_alloc_block(size_t size, size_t aligned_size)
+{
+    if (aligned_size == 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    /* ca_malloc_inline is inlined into its caller, which is the site */
+    return site_record(alloc_block(size, aligned_size, NULL), __builtin_return_address(0));
+}
+
+void ca_free_block(struct mem_block *block)
+{
+    if (g_report_pending) {
+        report_pending();
+    }
+    pthread_mutex_lock(&alloc_mutex);
+    LOG("Free request; address = %p, size = %zu\n", block + 1, block->size);
+
+    struct region *region = region_lookup(block);
+    if (region != NULL) {
+        region->live--;
+        region->in_use -= block->size;
+        fit_bound_raise(region);
+        g_heaps[region->owner].in_use -= block->size;
+    }
+    /* A region with nothing left in it is unmapped by merge_block */
+    bool emptied = region == NULL || region->in_use == 0;
+    block->free = true;
+    t_deallocated += block->size - sizeof(struct mem_block);
+    lifetime_record(block);
+    if (g_config.num_routes > 0) {
+        size_t index = route_for(block->size - sizeof(struct mem_block)) - g_config.routes;
+        g_route_stats[index].frees++;
+        g_route_stats[index].live_bytes -= block->size - sizeof(struct mem_block);
+    }
+    if (g_trace_fd != -1) {
+        trace_record('f', block + 1, 0);
+    }
+    struct mem_block *merged = ca_merge_block(block);
+    if (g_config.heaps && !emptied) {
+        region = region_lookup(merged);
+        if (region != NULL) {
+            heap_balance(region);
+        }
+    }
+    if (g_config.warm && merged != NULL) {
+        /* Every block merge_block absorbed is part of `merged`, so a warm
+         * pointer to one of them is replaced here */
+        region = region_touch(merged);
+        if (region != NULL) {
+            region->warm = merged;
+            t_warm_base = region->base;
+        }
+    }
+    pthread_mutex_unlock(&alloc_mutex);
+    // LOG("Block size: %zu\n", block->size);
+}
+
+void *ca_malloc(size_t size)
+{
+    return alloc_sampled(size, NULL, __builtin_return_address(0));
+}
+
+void ca_free(void *ptr)
+{
+    if (ptr == NULL) {
+        /* Freeing a NULL pointer does nothing */
+        return;
+    }
+    ca_free_block((struct mem_block *) ptr - 1);
+}
+
+void *ca_calloc(size_t nmemb, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        return NULL;
+    }
+    void *mem_block = alloc_sampled(total, NULL, __builtin_return_address(0));
+    if (mem_block == NULL) {
+        return NULL;
+    }
+    LOG("Writing 0 over memory block at %p\n", mem_block);
+    memset(mem_block, 0, total);
+    return mem_block;
+}
+
+void *ca_realloc(void *ptr, size_t size)
+{
+    LOG("Rellocation request; address = %p, new size = %zu\n", ptr, size);
+    if (ptr == NULL) {
+        /* If the pointer is NULL, then we simply malloc a new block */
+        return alloc_sampled(size, NULL, __builtin_return_address(0));
+    }
+
+    if (size == 0) {
+        /* Realloc to 0 is often the same as freeing the memory block... But the
+         * C standard doesn't require this. We will free the block and return
+         * NULL here. */
+        ca_free(ptr);
+        return NULL;
+    }
+    struct mem_block *block = (struct mem_block *) ptr - 1;
+    size_t old_size = block->size - sizeof(struct mem_block);
+
+    void *new_ptr = alloc_sampled(size, NULL, __builtin_return_address(0));
+    if (new_ptr == NULL) {
+        return NULL;
+    }
+    memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+    ca_free(ptr);
+    
+    return new_ptr;
+}
+
+uint64_t *allocator_thread_allocatedp(void)
+{
+    return &t_allocated;
+}
+
+uint64_t *allocator_thread_deallocatedp(void)
+{
+    return &t_deallocated;
+}
+
+void alloc_scope_begin(struct alloc_scope *scope)
+{
+    scope->allocated = t_allocated;
+    scope->deallocated = t_deallocated;
+}
+
+uint64_t alloc_scope_end(struct alloc_scope *scope)
+{
+    scope->allocated = t_allocated - scope->allocated;
+    scope->deallocated = t_deallocated - scope->deallocated;
+    return scope->allocated;
+}
+
+#ifndef ALLOCATOR_NO_INTERPOSE
+/* -- Interposed C library entry points (allocator.so) -- */
+void *malloc(size_t size) __attribute__((alias("ca_malloc")));
+void free(void *ptr) __attribute__((alias("ca_free")));
+void *calloc(size_t nmemb, size_t size) __attribute__((alias("ca_calloc")));
+void *realloc(void *ptr, size_t size) __attribute__((alias("ca_realloc")));
+
+/* The original unprefixed names of the helpers, for programs and tests
+ * written against them */
+struct mem_block *split_block(struct mem_block *block, size_t size) __attribute__((alias("ca_split_block")));
+struct mem_block *merge_block(struct mem_block *block) __attribute__((alias("ca_merge_block")));
+void *reuse(size_t size) __attribute__((alias("ca_reuse")));
+void *first_fit(size_t size) __attribute__((alias("ca_first_fit")));
+void *worst_fit(size_t size) __attribute__((alias("ca_worst_fit")));
+void *best_fit(size_t size) __attribute__((alias("ca_best_fit")));
+void *malloc_name(size_t size, char *name) __attribute__((alias("ca_malloc_name")));
+void print_memory(void) __attribute__((alias("ca_print_memory")));
+void print_stats(void) __attribute__((alias("ca_print_stats")));
+#endif
+
+/**
+ * print_memory
+ *
+ * Prints out the current memory state, including both the regions and blocks.
+ * Entries are printed in order, so there is an implied link from the topmost
+ * entry to the next, and so on.
+ */
+void ca_print_memory(void)
+{
+    puts("-- Current Memory State --");
+    struct mem_block *current_block = g_head;
+    struct mem_block *current_region = g_head;
+
+    while(current_block != NULL){
+        if(current_block->region_id != current_region->region_id || current_block == g_head){
+            struct region *region = region_lookup(current_block);
+            printf("[REGION] %lu] %p%s\n", current_block->region_id, current_block,
+                    region != NULL && region->kind == REGION_BOOTSTRAP ? " (bootstrap)" : "");
+            current_region = current_block;
+        }
+        printf("  [BLOCK] %p-%p \'%s' %zu [%s]\n", current_block, (char *) current_block + current_block->size, current_block->name, current_block->size, current_block->free ? "FREE" : "USED");
+        current_block = current_block->next;
+    }
+    
+}
+
+
+const char *alloc_tag_set(const char *tag)
+{
+    pthread_mutex_lock(&alloc_mutex);
+    const char *previous = t_tag != 0 ? g_tags[t_tag - 1] : NULL;
+    uint16_t id = 0;
+    if (tag != NULL) {
+        for (unsigned int i = 0; i < g_num_tags && id == 0; i++) {
+            if (strncmp(g_tags[i], tag, sizeof(g_tags[i]) - 1) == 0) {
+                id = i + 1;
+            }
+        }
+        if (id == 0 && g_num_tags < TAGS_MAX) {
+            config_set_path(g_tags[g_num_tags], sizeof(g_tags[g_num_tags]), tag, strlen(tag));
+            id = ++g_num_tags;
+        }
+    }
+    t_tag = id;
+    pthread_mutex_unlock(&alloc_mutex);
+    return previous;
+}
+
+size_t free_all_tagged(const char *tag)
+{
+    if (tag == NULL) {
+        return 0;
+    }
+    size_t released = 0;
+    pthread_mutex_lock(&alloc_mutex);
+    uint16_t id = 0;
+    for (unsigned int i = 0; i < g_num_tags && id == 0; i++) {
+        if (strncmp(g_tags[i], tag, sizeof(g_tags[i]) - 1) == 0) {
+            id = i + 1;
+        }
+    }
+
+    size_t slot = 0;
+    while (id != 0 && slot < g_region_count) {
+        struct region *region = g_region_dir[slot];
+        if (region->tag != id) {
+            slot++;
+            continue;
+        }
+
+        /* The region's blocks are consecutive in the list: unlink them all */
+        struct mem_block *first = (struct mem_block *) region->base;
+        struct mem_block *last = region->last;
+        if (first->prev != NULL) {
+            first->prev->next = last->next;
+        } else {
+            g_head = last->next;
+        }
+        if (last->next != NULL) {
+            last->next->prev = first->prev;
+        } else {
+            g_tail = first->prev;
+        }
+
+        /* Unmapping removes the region from the directory, so slot is next up */
+        released += region->size;
+        if (region_unmap(first, region->size) == -1) {
+            perror("munmap");
+        }
+    }
+    pthread_mutex_unlock(&alloc_mutex);
+    return released;
+}
+
+void allocator_disable(void)
+{
+    pthread_mutex_lock(&alloc_mutex);
+    t_disabled = true;
+}
+
+void allocator_enable(void)
+{
+    t_disabled = false;
+    pthread_mutex_unlock(&alloc_mutex);
+}
+
+int allocator_iterate(uintptr_t base, size_t size,
+        void (*callback)(uintptr_t base, size_t size, void *arg), void *arg)
+{
+    uintptr_t end = size > UINTPTR_MAX - base ? UINTPTR_MAX : base + size;
+    for (size_t slot = region_slot((void *) base);
+            slot < g_region_count && (uintptr_t) g_region_dir[slot]->base < end; slot++) {
+        struct region *region = g_region_dir[slot];
+        if (region->live == 0) {
+            continue;
+        }
+
+        /* A region's blocks are consecutive in the list, starting at its base */
+        struct mem_block *block = (struct mem_block *) region->base;
+        while (block != NULL && block->region_id == region->id && (uintptr_t) (block + 1) < end) {
+            uintptr_t data = (uintptr_t) (block + 1);
+            size_t data_size = block->size - sizeof(struct mem_block);
+            if (!block->free && data + data_size > base) {
+                callback(data, data_size, arg);
+            }
+            block = block->next;
+        }
+    }
+    return 0;
+}
+
+int allocator_block_of(const void *ptr, uintptr_t *base, size_t *size)
+{
+    bool locked = !t_disabled;
+    if (locked) {
+        pthread_mutex_lock(&alloc_mutex);
+    }
+    int result = -1;
+    struct region *region = region_lookup(ptr);
+    struct mem_block *block = NULL;
+    if (region != NULL && region->live > 0) {
+        block = region_block_at(region, ptr);
+    }
+    if (block != NULL) {
+        const char *data = (const char *) (block + 1);
+        if (!block->free && (const char *) ptr >= data
+                && (const char *) ptr < (const char *) block + block->size) {
+            *base = (uintptr_t) data;
+            *size = block->size - sizeof(struct mem_block);
+            result = 0;
+        }
+    }
+    if (locked) {
+        pthread_mutex_unlock(&alloc_mutex);
+    }
+    return result;
+}
+
+void allocator_set_page_provider(void *(*map)(size_t size, size_t align),
+        int (*unmap)(void *addr, size_t size), int (*grow)(void *addr, size_t size, size_t new_size))
+{
+    pthread_mutex_lock(&alloc_mutex);
+    g_page_map = map;
+    g_page_unmap = unmap;
+    g_page_grow = grow;
+    pthread_mutex_unlock(&alloc_mutex);
+}
+
+void allocator_stats(struct allocator_stats *stats)
+{
+    pthread_mutex_lock(&alloc_mutex);
+    stats->regions = g_region_count;
+    stats->extend_attempts = g_extend_attempts;
+    stats->extend_successes = g_extend_successes;
+    stats->region_bytes = g_mapped_bytes;
+    stats->hugepages = g_num_hugepages;
+    stats->hugepage_region_bytes = g_hugepage_bytes;
+    stats->near_requests = g_near_requests;
+    stats->near_hits = g_near_hits;
+    stats->warm_hits = g_warm_hits;
+    stats->file_regions = g_file_regions;
+    stats->file_bytes = g_file_bytes;
+    stats->heap_releases = g_heap_releases;
+    stats->heap_adoptions = g_heap_adoptions;
+    pthread_mutex_unlock(&alloc_mutex);
 }
 
-void *malloc(size_t size)
+void allocator_lifetimes(struct allocator_lifetimes *lifetimes)
 {
     pthread_mutex_lock(&alloc_mutex);
-    static const int prot_flags = PROT_READ | PROT_WRITE;
-    static const int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
-    size_t total_size = size + sizeof(struct mem_block);
-    size_t aligned_size = total_size;
-    if(aligned_size % ALIGN_SIZE != 0){
-        aligned_size = aligned_size + ALIGN_SIZE - (total_size % ALIGN_SIZE);
-    }
-    LOG("allocation request; size = %zu, total = %zu, aligned = %zu\n", size, total_size, aligned_size);
-    
-    char *scrabble = getenv("ALLOCATOR_SCRIBBLE");
-    bool scribbles = false;
-    if (scrabble != NULL && (atoi(scrabble) == 1)) {
-        scribbles = true;
+    memcpy(lifetimes->freed, g_lifetimes, sizeof(lifetimes->freed));
+    pthread_mutex_unlock(&alloc_mutex);
+}
+
+size_t allocator_route_stats(struct allocator_route_stats *routes, size_t max)
+{
+    pthread_mutex_lock(&alloc_mutex);
+    size_t count = g_config.num_routes;
+    for (size_t i = 0; i < count && i < max; i++) {
+        routes[i] = (struct allocator_route_stats) {
+            .limit = g_config.routes[i].limit,
+            .engine = g_config.routes[i].engine,
+            .allocations = g_route_stats[i].allocations,
+            .frees = g_route_stats[i].frees,
+            .live_bytes = g_route_stats[i].live_bytes,
+        };
+    }
+    pthread_mutex_unlock(&alloc_mutex);
+    return count;
+}
+
+/**
+ * print_stats
+ *
+ * Prints a summary of the allocator's statistics, including how much of the
+ * mapped memory is covered by filler hugepages.
+ */
+void ca_print_stats(void)
+{
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    double coverage = 0.0;
+    if (stats.region_bytes > 0) {
+        coverage = 100.0 * stats.hugepage_region_bytes / stats.region_bytes;
     }
+    puts("-- Allocator Stats --");
+    printf("Regions: %lu (%zu bytes)\n", stats.regions, stats.region_bytes);
+    printf("Hugepages: %lu (%zu bytes, %.1f%% of region bytes covered)\n",
+            stats.hugepages, stats.hugepages * HUGEPAGE_SIZE, coverage);
+    printf("In-place extensions: %lu of %lu attempts (%.1f%%)\n",
+            stats.extend_successes, stats.extend_attempts,
+            stats.extend_attempts ? 100.0 * stats.extend_successes / stats.extend_attempts : 0.0);
+    printf("Near allocations: %lu of %lu placed next to their hint\n",
+            stats.near_hits, stats.near_requests);
+    printf("Warm placements: %lu\n", stats.warm_hits);
+    printf("File-backed overflow: %lu regions (%zu bytes)\n", stats.file_regions, stats.file_bytes);
+    printf("Thread heaps: %lu regions released to the global pool, %lu adopted\n",
+            stats.heap_releases, stats.heap_adoptions);
 
-    struct mem_block *reused_block = reuse(aligned_size);
-    if(reused_block != NULL){
-        reused_block->free = false;
-        if (scribbles) {
-            memset(reused_block + 1, 0xAA, size);
+    struct allocator_route_stats routes[ROUTES_MAX + 1];
+    size_t num_routes = allocator_route_stats(routes, ROUTES_MAX + 1);
+    for (size_t i = 0; i < num_routes; i++) {
+        if (routes[i].limit == SIZE_MAX) {
+            printf("Route rest");
+        } else {
+            printf("Route <= %zu", routes[i].limit);
         }
-        pthread_mutex_unlock(&alloc_mutex);
-        return reused_block + 1;
+        printf(" (%s): %lu allocations, %lu frees, %zu live bytes\n", routes[i].engine,
+                routes[i].allocations, routes[i].frees, routes[i].live_bytes);
     }
+}
 
-    int page_size = getpagesize();
-    size_t num_pages = aligned_size / page_size;
-    if (aligned_size % page_size != 0){
-        num_pages++;
+/**
+ * A tag or sampled call site in a heap snapshot. Tag entries have a name and
+ * no site; site entries have a site and an empty name.
+ */
+struct heap_snapshot_entry {
+    char tag[32]; /*!< Block name for tag entries */
+    uintptr_t site; /*!< Call site for sampled site entries */
+    size_t bytes; /*!< Live bytes (usable size) */
+    unsigned long blocks; /*!< Live blocks */
+};
+
+/**
+ * Live bytes per tag and per sampled site at one point in time. Entries are
+ * kept in an open-addressed table so a snapshot is one pass over the heap.
+ */
+struct heap_snapshot {
+    size_t live_bytes; /*!< All live bytes, tagged or not */
+    unsigned long live_blocks; /*!< All live blocks */
+    bool truncated; /*!< Some tags or sites didn't fit in the table */
+    struct heap_snapshot_entry entries[SNAPSHOT_SLOTS];
+};
+
+/**
+ * Probes the table for a tag (or, if tag is NULL, a site).
+ *
+ * @return index of the matching entry or of the empty slot where it belongs,
+ * or -1 if the table is full
+ */
+static int snapshot_probe(const struct heap_snapshot *snapshot, const char *tag, uintptr_t site)
+{
+    uint64_t hash = 14695981039346656037UL;
+    if (tag != NULL) {
+        for (size_t i = 0; i < sizeof(snapshot->entries[0].tag) && tag[i] != '\0'; i++) {
+            hash = (hash ^ (unsigned char) tag[i]) * 1099511628211UL;
+        }
+    } else {
+        hash = (hash ^ site) * 1099511628211UL;
     }
 
-    size_t region_size = num_pages * page_size;
-    LOG("New region; size = %zu\n", region_size);
-    
-    struct mem_block *new_block = mmap(NULL, region_size, prot_flags, map_flags, -1, 0);
-    
-    if (new_block == MAP_FAILED) {
+    for (unsigned int probe = 0; probe < SNAPSHOT_SLOTS; probe++) {
+        int index = (hash + probe) & (SNAPSHOT_SLOTS - 1);
+        const struct heap_snapshot_entry *entry = &snapshot->entries[index];
+        if (entry->blocks == 0) {
+            return index;
+        }
+        if (tag != NULL && entry->site == 0
+                && strncmp(entry->tag, tag, sizeof(entry->tag) - 1) == 0) {
+            return index;
+        }
+        if (tag == NULL && entry->site == site) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+static void snapshot_add(struct heap_snapshot *snapshot, const char *tag, uintptr_t site, size_t bytes)
+{
+    int index = snapshot_probe(snapshot, tag, site);
+    if (index == -1) {
+        snapshot->truncated = true;
+        return;
+    }
+    struct heap_snapshot_entry *entry = &snapshot->entries[index];
+    if (entry->blocks == 0) {
+        if (tag != NULL) {
+            strncpy(entry->tag, tag, sizeof(entry->tag) - 1);
+        } else {
+            entry->site = site;
+        }
+    }
+    entry->bytes += bytes;
+    entry->blocks++;
+}
+
+struct heap_snapshot *heap_snapshot_take(void)
+{
+    /* Mapped directly so taking a snapshot doesn't perturb the heap */
+    struct heap_snapshot *snapshot = mmap(NULL, sizeof(struct heap_snapshot),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (snapshot == MAP_FAILED) {
         perror("mmap");
-        pthread_mutex_unlock(&alloc_mutex);
         return NULL;
     }
 
-    snprintf(new_block->name, 32, "Allocation %lu", g_allocations++);
-    new_block->region_id = g_regions++;
+    pthread_mutex_lock(&alloc_mutex);
+    for (struct mem_block *block = g_head; block != NULL; block = block->next) {
+        if (block->free) {
+            continue;
+        }
+        size_t bytes = block->size - sizeof(struct mem_block);
+        snapshot->live_bytes += bytes;
+        snapshot->live_blocks++;
+        if (block->flags & BLOCK_NAMED) {
+            snapshot_add(snapshot, block->name, 0, bytes);
+        }
+        if ((block->flags & BLOCK_SAMPLED) && block->site != 0) {
+            snapshot_add(snapshot, NULL, block->site, bytes);
+        }
+    }
+    pthread_mutex_unlock(&alloc_mutex);
+    return snapshot;
+}
 
-    if(g_head == NULL && g_tail == NULL){
-        g_head = new_block;
-        g_tail = g_head;
-        new_block->prev = NULL;
+/**
+ * Looks up the entry in `snapshot` with the same tag or site as `key`.
+ *
+ * @return the entry or NULL if the snapshot doesn't have it
+ */
+static const struct heap_snapshot_entry *snapshot_find(const struct heap_snapshot *snapshot,
+        const struct heap_snapshot_entry *key)
+{
+    int index = snapshot_probe(snapshot, key->site == 0 ? key->tag : NULL, key->site);
+    if (index == -1 || snapshot->entries[index].blocks == 0) {
+        return NULL;
     }
-    else{
-        g_tail->next = new_block;
-        new_block->prev = g_tail;
-        g_tail = new_block;
+    return &snapshot->entries[index];
+}
+
+unsigned int heap_snapshot_diff(const struct heap_snapshot *a, const struct heap_snapshot *b)
+{
+    ssize_t growth[SNAPSHOT_SLOTS];
+    unsigned int grew = 0;
+    for (unsigned int i = 0; i < SNAPSHOT_SLOTS; i++) {
+        const struct heap_snapshot_entry *after = &b->entries[i];
+        growth[i] = 0;
+        if (after->blocks == 0) {
+            continue;
+        }
+        const struct heap_snapshot_entry *before = snapshot_find(a, after);
+        growth[i] = (ssize_t) after->bytes - (ssize_t) (before ? before->bytes : 0);
+        if (growth[i] > 0) {
+            grew++;
+        }
     }
 
-    new_block->free = true;
-    new_block->size = region_size;
-    new_block->next = NULL;
-    split_block(new_block, aligned_size);
-    new_block->free = false;
+    puts("-- Heap Growth --");
+    printf("Live: %+zd bytes (%+ld blocks), now %zu bytes%s\n",
+            (ssize_t) b->live_bytes - (ssize_t) a->live_bytes,
+            (long) b->live_blocks - (long) a->live_blocks, b->live_bytes,
+            a->truncated || b->truncated ? " [truncated]" : "");
+    for (unsigned int shown = 0; shown < grew && shown < SNAPSHOT_REPORT_TOP; shown++) {
+        unsigned int top = 0;
+        for (unsigned int i = 1; i < SNAPSHOT_SLOTS; i++) {
+            if (growth[i] > growth[top]) {
+                top = i;
+            }
+        }
+        const struct heap_snapshot_entry *entry = &b->entries[top];
+        if (entry->site == 0) {
+            printf("  [TAG] '%s' %+zd bytes, now %zu bytes in %lu blocks\n",
+                    entry->tag, growth[top], entry->bytes, entry->blocks);
+        } else {
+            printf("  [SITE] %p %+zd bytes, now %zu bytes in %lu sampled blocks\n",
+                    (void *) entry->site, growth[top], entry->bytes, entry->blocks);
+        }
+        growth[top] = 0;
+    }
+    return grew;
+}
 
-    LOG("New allocation %p (data = %p)\n", new_block, new_block + 1);
-    if (scribbles) {
-        memset(new_block + 1, 0xAA, size);
+void heap_snapshot_free(struct heap_snapshot *snapshot)
+{
+    if (snapshot != NULL) {
+        munmap(snapshot, sizeof(struct heap_snapshot));
+    }
+}
+
+/**
+ * Prints the largest entries of a snapshot, either its tags or its sites.
+ */
+static void report_top(int fd, const struct heap_snapshot *snapshot, bool sites)
+{
+    bool shown[SNAPSHOT_SLOTS] = { false };
+    for (unsigned int n = 0; n < HEAP_REPORT_TOP; n++) {
+        const struct heap_snapshot_entry *top = NULL;
+        unsigned int top_index = 0;
+        for (unsigned int i = 0; i < SNAPSHOT_SLOTS; i++) {
+            const struct heap_snapshot_entry *entry = &snapshot->entries[i];
+            if (shown[i] || entry->blocks == 0 || (entry->site != 0) != sites) {
+                continue;
+            }
+            if (top == NULL || entry->bytes > top->bytes) {
+                top = entry;
+                top_index = i;
+            }
+        }
+        if (top == NULL) {
+            break;
+        }
+        shown[top_index] = true;
+        if (sites) {
+            dprintf(fd, "  [SITE] %p %zu bytes in %lu sampled blocks\n",
+                    (void *) top->site, top->bytes, top->blocks);
+        } else {
+            dprintf(fd, "  [TAG] '%s' %zu bytes in %lu blocks\n",
+                    top->tag, top->bytes, top->blocks);
+        }
+    }
+}
+
+/**
+ * Returns the lifetime bucket below which `fraction` of a histogram's
+ * entries fall.
+ */
+static unsigned int lifetime_percentile(const uint64_t *buckets, uint64_t total, double fraction)
+{
+    uint64_t seen = 0;
+    for (unsigned int b = 0; b < CA_LIFETIME_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen >= fraction * total) {
+            return b;
+        }
+    }
+    return CA_LIFETIME_BUCKETS - 1;
+}
+
+/**
+ * Writes the median and 90th percentile lifetime of each size class that
+ * has seen frees, as powers of two.
+ */
+static void report_lifetimes(int fd)
+{
+    struct allocator_lifetimes lifetimes;
+    allocator_lifetimes(&lifetimes);
+    dprintf(fd, "Lifetimes (allocations survived, freed blocks only):\n");
+    for (unsigned int c = 0; c < CA_LIFETIME_CLASSES; c++) {
+        uint64_t total = 0;
+        for (unsigned int b = 0; b < CA_LIFETIME_BUCKETS; b++) {
+            total += lifetimes.freed[c][b];
+        }
+        if (total == 0) {
+            continue;
+        }
+        if (c < CA_LIFETIME_CLASSES - 1) {
+            dprintf(fd, "  <= %7lu B:", 64UL << (2 * c));
+        } else {
+            dprintf(fd, "  larger:     ");
+        }
+        dprintf(fd, " %10llu freed, median < 2^%u, p90 < 2^%u\n", (unsigned long long) total,
+                lifetime_percentile(lifetimes.freed[c], total, 0.5),
+                lifetime_percentile(lifetimes.freed[c], total, 0.9));
     }
-    pthread_mutex_unlock(&alloc_mutex);
-    return new_block + 1;
 }
 
-void free(void *ptr)
+int heap_report_write(int fd)
 {
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+
+    size_t free_bytes = 0, largest_free = 0;
+    unsigned long free_blocks = 0;
     pthread_mutex_lock(&alloc_mutex);
-    if (ptr == NULL) {
-        /* Freeing a NULL pointer does nothing */
-        pthread_mutex_unlock(&alloc_mutex);
+    for (struct mem_block *block = g_head; block != NULL; block = block->next) {
+        if (block->free) {
+            free_bytes += block->size;
+            free_blocks++;
+            if (block->size > largest_free) {
+                largest_free = block->size;
+            }
+        }
+    }
+    pthread_mutex_unlock(&alloc_mutex);
+
+    struct heap_snapshot *snapshot = heap_snapshot_take();
+    if (snapshot == NULL) {
+        return -1;
+    }
+
+    double fragmentation = 0.0;
+    if (free_bytes > 0) {
+        fragmentation = 100.0 * (1.0 - (double) largest_free / free_bytes);
+    }
+    dprintf(fd, "-- Heap Report (pid %d, time %ld) --\n", getpid(), (long) time(NULL));
+    dprintf(fd, "Regions: %lu (%zu bytes), hugepages: %lu (%zu region bytes)\n",
+            stats.regions, stats.region_bytes, stats.hugepages, stats.hugepage_region_bytes);
+    dprintf(fd, "In-place extensions: %lu of %lu attempts\n",
+            stats.extend_successes, stats.extend_attempts);
+    dprintf(fd, "File-backed overflow: %lu regions (%zu bytes)\n",
+            stats.file_regions, stats.file_bytes);
+    dprintf(fd, "Live: %zu bytes in %lu blocks%s\n", snapshot->live_bytes,
+            snapshot->live_blocks, snapshot->truncated ? " [truncated]" : "");
+    dprintf(fd, "Free: %zu bytes in %lu blocks, largest %zu (%.1f%% fragmented)\n",
+            free_bytes, free_blocks, largest_free, fragmentation);
+    report_lifetimes(fd);
+    dprintf(fd, "Top tags:\n");
+    report_top(fd, snapshot, false);
+    dprintf(fd, "Top sampled sites:\n");
+    report_top(fd, snapshot, true);
+    heap_snapshot_free(snapshot);
+    return 0;
+}
+
+/**
+ * Writes the heap report requested by the report signal. Called from the
+ * allocator entry points before the lock is taken; of the threads that see
+ * the request, only the one that clears it writes the report.
+ */
+static void report_pending(void)
+{
+    if (__atomic_exchange_n(&g_report_pending, 0, __ATOMIC_ACQ_REL) == 0) {
         return;
     }
-    struct mem_block *block = (struct mem_block *) ptr - 1;
-    LOG("Free request; address = %p, size = %zu\n", ptr, block->size);
+    int fd = STDERR_FILENO;
+    if (g_config.report_path[0] != '\0') {
+        fd = open(g_config.report_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            perror("open");
+            return;
+        }
+    }
+    heap_report_write(fd);
+    if (fd != STDERR_FILENO) {
+        close(fd);
+    }
+}
 
-    block->free = true;
-    merge_block(block);
+/* -- Control channel -- */
+
+static char g_control_bound[sizeof(((struct sockaddr_un *) NULL)->sun_path)]; /*!< Socket path we created */
+static pid_t g_control_pid = 0; /*!< Process that created it; forked children leave it alone */
+
+/**
+ * Returns the pages inside free blocks to the kernel. The header at the
+ * start of each block stays, so only whole pages past it are released; the
+ * rest of the heap is untouched. Must be called with the allocator lock held.
+ *
+ * @return bytes released
+ */
+static size_t purge_free_pages(void)
+{
+    uintptr_t page_size = getpagesize();
+    size_t purged = 0;
+    for (struct mem_block *block = g_head; block != NULL; block = block->next) {
+        if (!block->free) {
+            continue;
+        }
+        uintptr_t start = ((uintptr_t) (block + 1) + page_size - 1) & ~(page_size - 1);
+        uintptr_t end = ((uintptr_t) block + block->size) & ~(page_size - 1);
+        if (end > start && madvise((void *) start, end - start, MADV_DONTNEED) == 0) {
+            purged += end - start;
+        }
+    }
+    return purged;
+}
+
+/**
+ * Forms a value given to a set command must take.
+ */
+enum control_value {
+    CONTROL_ENGINE, /*!< Name of a placement engine */
+    CONTROL_FLAG, /*!< 0 or 1 */
+    CONTROL_COUNT, /*!< Decimal number */
+    CONTROL_PERCENT, /*!< Decimal number up to 100 */
+    CONTROL_SIZE, /*!< Byte count with an optional K, M or G suffix */
+};
+
+/**
+ * Options that can change while the process runs. The rest decide how
+ * regions were mapped or are read without the lock, so they stay fixed,
+ * as do the engine and scribbling when a specialized build compiled them in
+ * or out.
+ */
+static const struct {
+    const char *key;
+    enum control_value value;
+} g_control_keys[] = {
+#ifndef ALLOCATOR_ENGINE
+    { "algorithm", CONTROL_ENGINE },
+#endif
+#if ALLOCATOR_SCRIBBLE_SUPPORT
+    { "scribble", CONTROL_FLAG },
+#endif
+    { "sample", CONTROL_COUNT },
+    { "warm", CONTROL_FLAG },
+    { "emptiness", CONTROL_PERCENT },
+    { "overflow_budget", CONTROL_SIZE },
+    { "overflow_threshold", CONTROL_SIZE },
+};
+
+/**
+ * Checks that `value` has the form `kind` asks for. Unlike the environment,
+ * which falls back to defaults, a set command must not apply a typo.
+ */
+static bool control_value_ok(enum control_value kind, const char *value, size_t value_len)
+{
+    if (kind == CONTROL_ENGINE) {
+        for (size_t i = 0; i < sizeof(g_engines) / sizeof(g_engines[0]); i++) {
+            if (strlen(g_engines[i].name) == value_len && strncmp(g_engines[i].name, value, value_len) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (kind == CONTROL_FLAG) {
+        return value_len == 1 && (value[0] == '0' || value[0] == '1');
+    }
+
+    size_t digits = strspn(value, "0123456789");
+    if (digits == 0) {
+        return false;
+    }
+    errno = 0;
+    unsigned long number = strtoul(value, NULL, 10);
+    if (errno == ERANGE || (kind == CONTROL_PERCENT && number > 100)) {
+        return false;
+    }
+    if (kind == CONTROL_SIZE && digits + 1 == value_len) {
+        return strchr("KkMmGg", value[digits]) != NULL;
+    }
+    return digits == value_len;
+}
+/**
+ * Applies "key:value,..." options from a set command under the lock, so
+ * they take effect between two allocations. Nothing is applied unless every
+ * key can be set and every value is valid.
+ */
+static void control_set(int fd, const char *options)
+{
+    for (const char *opt = options; *opt != '\0'; ) {
+        const char *sep = strchr(opt, ':');
+        size_t key_len = sep != NULL ? (size_t) (sep - opt) : strcspn(opt, ",");
+        size_t i = 0;
+        while (i < sizeof(g_control_keys) / sizeof(g_control_keys[0])
+                && (strlen(g_control_keys[i].key) != key_len
+                    || strncmp(g_control_keys[i].key, opt, key_len) != 0)) {
+            i++;
+        }
+        if (sep == NULL || sep > opt + strcspn(opt, ",") || i == sizeof(g_control_keys) / sizeof(g_control_keys[0])) {
+            dprintf(fd, "ERR cannot set '%.*s' at runtime\n", (int) key_len, opt);
+            return;
+        }
+        size_t value_len = strcspn(sep + 1, ",");
+        if (!control_value_ok(g_control_keys[i].value, sep + 1, value_len)) {
+            dprintf(fd, "ERR bad value '%.*s' for '%.*s'\n", (int) value_len, sep + 1, (int) key_len, opt);
+            return;
+        }
+        opt += strcspn(opt, ",");
+        if (*opt == ',') {
+            opt++;
+        }
+    }
+
+    pthread_mutex_lock(&alloc_mutex);
+    for (const char *opt = options; *opt != '\0'; ) {
+        const char *sep = strchr(opt, ':');
+        config_set(opt, sep - opt, sep + 1);
+        if (sep - opt == 6 && strncmp(opt, "sample", 6) == 0) {
+            /* Start counting down from the new interval right away */
+            g_sample_countdown = 0;
+        }
+        opt += strcspn(opt, ",");
+        if (*opt == ',') {
+            opt++;
+        }
+    }
     pthread_mutex_unlock(&alloc_mutex);
-    // LOG("Block size: %zu\n", block->size);
+    dprintf(fd, "OK\n");
 }
 
-void *calloc(size_t nmemb, size_t size)
+/**
+ * Writes counters and the tunable settings as "name value" lines.
+ */
+static void control_stats(int fd)
 {
-    void *mem_block = malloc(nmemb * size);
-    LOG("Writing 0 over memory block at %p\n", mem_block);
-    memset(mem_block, 0, nmemb * size);
-    return mem_block;
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+#ifdef ALLOCATOR_ENGINE
+    const char *algorithm = ENGINE_NAME(ALLOCATOR_ENGINE);
+    pthread_mutex_lock(&alloc_mutex);
+#else
+    const char *algorithm = "none";
+    pthread_mutex_lock(&alloc_mutex);
+    for (size_t i = 0; i < sizeof(g_engines) / sizeof(g_engines[0]); i++) {
+        if (g_config.engine == g_engines[i].fit) {
+            algorithm = g_engines[i].name;
+        }
+    }
+#endif
+    unsigned long sample = g_config.sample_interval;
+    bool warm = g_config.warm;
+    pthread_mutex_unlock(&alloc_mutex);
+
+    dprintf(fd, "regions %lu\nregion_bytes %zu\nhugepages %lu\nhugepage_region_bytes %zu\n"
+            "extend_attempts %lu\nextend_successes %lu\nnear_requests %lu\nnear_hits %lu\n"
+            "warm_hits %lu\nfile_regions %lu\nfile_bytes %zu\nheap_releases %lu\n"
+            "heap_adoptions %lu\nalgorithm %s\nsample %lu\nwarm %d\nOK\n",
+            stats.regions, stats.region_bytes, stats.hugepages, stats.hugepage_region_bytes,
+            stats.extend_attempts, stats.extend_successes, stats.near_requests, stats.near_hits,
+            stats.warm_hits, stats.file_regions, stats.file_bytes, stats.heap_releases,
+            stats.heap_adoptions, algorithm, sample, warm);
 }
 
-void *realloc(void *ptr, size_t size)
+static void control_command(int fd, char *line)
 {
-    LOG("Rellocation request; address = %p, new size = %zu\n", ptr, size);
-    if (ptr == NULL) {
-        /* If the pointer is NULL, then we simply malloc a new block */
-        return malloc(size);
+    line[strcspn(line, "\r\n")] = '\0';
+    char *args = line + strcspn(line, " ");
+    if (*args != '\0') {
+        *args++ = '\0';
+        args += strspn(args, " ");
     }
 
-    if (size == 0) {
-        /* Realloc to 0 is often the same as freeing the memory block... But the
-         * C standard doesn't require this. We will free the block and return
-         * NULL here. */
-        free(ptr);
-        return NULL;
+    if (strcmp(line, "purge") == 0) {
+        pthread_mutex_lock(&alloc_mutex);
+        size_t purged = purge_free_pages();
+        pthread_mutex_unlock(&alloc_mutex);
+        dprintf(fd, "purged %zu\nOK\n", purged);
+    } else if (strcmp(line, "set") == 0 && *args != '\0') {
+        control_set(fd, args);
+    } else if (strcmp(line, "stats") == 0) {
+        control_stats(fd);
+    } else if (strcmp(line, "report") == 0) {
+        dprintf(fd, heap_report_write(fd) == 0 ? "OK\n" : "ERR report failed\n");
+    } else if (strcmp(line, "help") == 0) {
+        dprintf(fd, "purge\nset key:value[,key:value...]\nstats\nreport\nOK\n");
+    } else {
+        dprintf(fd, "ERR unknown command '%s'\n", line);
     }
-    struct mem_block *block = (struct mem_block *) ptr - 1;
-    
-    block = malloc(size);
-    memcpy(block, ptr, size);
-    
-    return block;
 }
 
 /**
- * print_memory
+ * Serves the control socket: one client at a time, one command per line.
+ * The thread spends its life blocked in accept() or read(), so allocations
+ * never see it; a command takes the allocator lock only while it applies.
+ */
+static void *control_serve(void *arg)
+{
+    int listener = (int) (intptr_t) arg;
+    while (true) {
+        int conn = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (conn == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return NULL;
+        }
+        /* A client that stops talking can't hold the channel forever */
+        struct timeval timeout = { .tv_sec = 5 };
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        char buf[512];
+        size_t len = 0;
+        ssize_t n;
+        while ((n = read(conn, buf + len, sizeof(buf) - 1 - len)) > 0) {
+            len += n;
+            buf[len] = '\0';
+            char *newline;
+            while ((newline = strchr(buf, '\n')) != NULL) {
+                *newline = '\0';
+                control_command(conn, buf);
+                len -= newline + 1 - buf;
+                memmove(buf, newline + 1, len + 1);
+            }
+            if (len == sizeof(buf) - 1) {
+                dprintf(conn, "ERR line too long\n");
+                len = 0;
+            }
+        }
+        if (len > 0) {
+            control_command(conn, buf);
+        }
+        close(conn);
+    }
+}
+
+/**
+ * Binds the control socket, replacing a stale one left by a process that
+ * is gone, but never one that is still being served.
  *
- * Prints out the current memory state, including both the regions and blocks.
- * Entries are printed in order, so there is an implied link from the topmost
- * entry to the next, and so on.
+ * @return the listening socket, or -1
  */
-void print_memory(void)
+static int control_listen(const char *path)
 {
-    puts("-- Current Memory State --");
-    struct mem_block *current_block = g_head;
-    struct mem_block *current_region = g_head;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    mode_t mask = umask(077);
+    int bound = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    if (bound == -1 && errno == EADDRINUSE
+            && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 && errno == ECONNREFUSED) {
+        unlink(path);
+        close(fd);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bound = fd == -1 ? -1 : bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    }
+    umask(mask);
+    if (bound == -1 || listen(fd, 4) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
 
-    while(current_block != NULL){
-        if(current_block->region_id != current_region->region_id || current_block == g_head){
-            printf("[REGION] %lu] %p\n", current_block->region_id, current_block);
-            current_region = current_block;
+/**
+ * Starts the control channel when ALLOCATOR_CONTROL (or the control key of
+ * ALLOCATOR_CONF) names a socket. "%p" in the path is replaced by the
+ * process id, so every process of a preloaded pipeline can have its own.
+ * Runs as a constructor, outside the allocator lock, since creating a
+ * thread allocates. Only the socket path is read here: the rest of the
+ * configuration still waits for the first allocation, so a program can
+ * change the environment in main.
+ */
+__attribute__((constructor)) static void control_start(void)
+{
+    size_t path_len;
+    const char *path = config_lookup("ALLOCATOR_CONTROL", "control", &path_len);
+    if (path == NULL || path_len == 0) {
+        return;
+    }
+
+    size_t len = 0;
+    for (const char *in = path; in < path + path_len && len < sizeof(g_control_bound); in++) {
+        if (in[0] == '%' && in + 1 < path + path_len && in[1] == 'p') {
+            len += snprintf(g_control_bound + len, sizeof(g_control_bound) - len, "%d", getpid());
+            in++;
+        } else {
+            g_control_bound[len++] = *in;
         }
-        printf("  [BLOCK] %p-%p \'%s' %zu [%s]\n", current_block, (char *) current_block + current_block->size, current_block->name, current_block->size, current_block->free ? "FREE" : "USED");
-        current_block = current_block->next;
     }
-    
+    if (len >= sizeof(g_control_bound)) {
+        /* A truncated path could name some other socket: stay off */
+        g_control_bound[0] = '\0';
+        return;
+    }
+    g_control_bound[len] = '\0';
+
+    int listener = control_listen(g_control_bound);
+    if (listener == -1) {
+        g_control_bound[0] = '\0';
+        return;
+    }
+
+    /* Signals meant for the program must not land on the control thread */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, control_serve, (void *) (intptr_t) listener) == 0) {
+        pthread_detach(thread);
+        g_control_pid = getpid();
+    } else {
+        close(listener);
+        unlink(g_control_bound);
+        g_control_bound[0] = '\0';
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
 }
 
+__attribute__((destructor)) static void control_finish(void)
+{
+    if (g_control_bound[0] != '\0' && g_control_pid == getpid()) {
+        unlink(g_control_bound);
+    }
+}
@@ -9,10 +9,22 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct allocator_stats;
+struct allocator_route_stats;
+struct allocator_lifetimes;
+struct heap_snapshot;
+struct alloc_scope;
+struct mem_block;
 
 /* -- Helper functions -- */
 /**
- * Split_block takes in a free memory block and splits the block into two blocks according to size
+ * ca_split_block takes in a free memory block and splits the block into two blocks according to size
  * @param block the free block that is getting split
  * @param size the size the block should get limited to. 
  * This is the new size of block. The other block is now a free block
@@ -20,103 +32,398 @@
  * @return returns the second block that is now free memory block. Returns NULL if block can't be split
  * 
  */
-struct mem_block *split_block(struct mem_block *block, size_t size);
+struct mem_block *ca_split_block(struct mem_block *block, size_t size);
 
 /**
- * merge_block takes in a free memory block merges with it's neighbor blocks, prev and next.
+ * ca_merge_block takes in a free memory block merges with it's neighbor blocks, prev and next.
  * @param block the free block will merge with next and prev
  * 
  * @return return the block that was merged or NULL if it couldn't merge
  * 
  */
-struct mem_block *merge_block(struct mem_block *block);
+struct mem_block *ca_merge_block(struct mem_block *block);
 
 /**
- * reuse determines which free space management algorithm to use for reusing a block of free memory
+ * ca_reuse determines which free space management algorithm to use for reusing a block of free memory
  * @param size the alligned size to set the reused block to 
  * 
  * @return returns pointer to block being reused
  * 
  */
-void *reuse(size_t size);
+void *ca_reuse(size_t size);
 
 /**
- * first_fit free space memory algorithm determines the first suitable block to use
+ * ca_first_fit free space memory algorithm determines the first suitable block to use
  * @param size the alligned size to compare with linked list blocks
  * 
  * @return returns pointer to first suitable block or NULL is there is no suitable block
  * 
  */
-void *first_fit(size_t size);
+void *ca_first_fit(size_t size);
 
 /**
- * worst_fit free space memory algorithm determines the worst suitable block to use
+ * ca_worst_fit free space memory algorithm determines the worst suitable block to use
  * @param size the alligned size to compare with linked list blocks
  * 
  * @return returns pointer to worst block or NULL if no suitable block
  * 
  */
-void *worst_fit(size_t size);
+void *ca_worst_fit(size_t size);
 
 /**
- * best_fit free space memory algorithm determines the best suitable block to use
+ * ca_best_fit free space memory algorithm determines the best suitable block to use
  * @param size the alligned size to compare with linked list blocks
  * 
  * @return returns pointer best suitable block or NULL if no suitable block
  * 
  */
-void *best_fit(size_t size);
+void *ca_best_fit(size_t size);
+
+/**
+ * ca_print_memory prints the linked list of memory with regions and blocks
+ */
+void ca_print_memory(void);
+
+/**
+ * allocator_stats takes a consistent snapshot of the allocator's statistics
+ * @param stats struct that is filled in with the current statistics
+ */
+void allocator_stats(struct allocator_stats *stats);
+
+/**
+ * allocator_route_stats reports the counters of each size range configured
+ * with ALLOCATOR_ROUTES
+ * @param routes array that is filled in, in order of increasing limit
+ * @param max number of entries routes has room for
+ *
+ * @return number of routes configured (0 if routing is off), which may be
+ * more than max
+ */
+size_t allocator_route_stats(struct allocator_route_stats *routes, size_t max);
+
+/**
+ * allocator_lifetimes copies the lifetime histograms of freed allocations
+ * @param lifetimes struct that is filled in
+ */
+void allocator_lifetimes(struct allocator_lifetimes *lifetimes);
+
+/**
+ * ca_print_stats prints the allocator statistics, including hugepage coverage
+ */
+void ca_print_stats(void);
+
+/**
+ * allocator_set_page_provider replaces mmap as the source of pages for
+ * regions and filler hugepages. Used by the capacity simulator to run the
+ * real placement engines against simulated memory. Must be called before the
+ * first allocation.
+ * @param map returns `size` bytes aligned to `align` (a power of two no
+ * smaller than the page size), or MAP_FAILED
+ * @param unmap releases pages from map, returning 0 on success
+ * @param grow extends pages from map at `addr` from `size` to `new_size`
+ * bytes without moving them, returning 0 on success or -1 if the pages after
+ * them are taken. May be NULL, in which case regions never grow in place.
+ */
+void allocator_set_page_provider(void *(*map)(size_t size, size_t align),
+        int (*unmap)(void *addr, size_t size), int (*grow)(void *addr, size_t size, size_t new_size));
+
+/* -- Accounting -- */
+/**
+ * allocator_thread_allocatedp returns a pointer to the calling thread's
+ * counter of bytes allocated. The counter only increases, so it can be read
+ * with a plain load at any time; the pointer is only valid in this thread.
+ *
+ * @return pointer to the calling thread's allocated byte counter
+ */
+uint64_t *allocator_thread_allocatedp(void);
+
+/**
+ * allocator_thread_deallocatedp returns a pointer to the calling thread's
+ * counter of bytes freed. Like the allocated counter, it only increases.
+ *
+ * @return pointer to the calling thread's deallocated byte counter
+ */
+uint64_t *allocator_thread_deallocatedp(void);
 
 /**
- * print_memory prints the linked list of memory with regions and blocks
+ * alloc_scope_begin records the calling thread's counters at the start of a scope
+ * @param scope scope to start
  */
-void print_memory(void);
+void alloc_scope_begin(struct alloc_scope *scope);
+
+/**
+ * alloc_scope_end turns the scope into the bytes allocated and freed by the
+ * calling thread since alloc_scope_begin
+ * @param scope scope started with alloc_scope_begin on the same thread
+ *
+ * @return bytes allocated within the scope
+ */
+uint64_t alloc_scope_end(struct alloc_scope *scope);
 
 /* -- C Memory API functions -- */
 /**
- * malloc_name does a malloc but also assigns pointer a name from struct for debugging
+ * ca_malloc_name does a malloc but also assigns pointer a name from struct for debugging
  * @param size size to malloc
  * @param name name of the allocation that is assigned to struct member variable
  * 
  * @return returns pointer best suitable block or NULL if no suitable block
  */
-void *malloc_name(size_t size, char *name);
+void *ca_malloc_name(size_t size, char *name);
+
+/**
+ * malloc_near allocates memory close to an existing allocation, so objects
+ * that are used together (a tree node and its children, list neighbors)
+ * share pages and cache lines. Free blocks in the same region as `hint` are
+ * searched outward from it, nearest first; if none close by fits, or the
+ * size is routed to mmap, this behaves like ca_malloc.
+ * @param hint pointer returned by this allocator and not yet freed, or NULL;
+ * any other pointer is ignored
+ * @param size size to malloc
+ *
+ * @return pointer to the allocated memory, or NULL
+ */
+void *malloc_near(const void *hint, size_t size);
+
+/* -- Reference-counted allocations -- */
+/**
+ * rc_alloc allocates memory with a reference count of 1. The count lives in
+ * the block header, so a counted object costs one allocation and one cache
+ * line instead of a separate count struct or wrapper. The memory must be
+ * released with rc_release, not free or realloc.
+ * @param size size to malloc
+ *
+ * @return pointer to the allocated memory, or NULL
+ */
+void *rc_alloc(size_t size);
+
+/**
+ * rc_retain atomically adds a reference to an rc_alloc allocation.
+ * @param ptr pointer returned by rc_alloc
+ *
+ * @return ptr, so retaining can be combined with storing the pointer
+ */
+void *rc_retain(void *ptr);
 
 /**
- * malloc allocates memory. requests memory from kernel and updates linked list 
+ * rc_release atomically drops a reference and frees the allocation when the
+ * last one is gone. Releasing NULL does nothing.
+ * @param ptr pointer returned by rc_alloc
+ *
+ * @return references left; 0 when the allocation was freed
+ */
+uint32_t rc_release(void *ptr);
+
+/**
+ * ca_malloc allocates memory. requests memory from kernel and updates linked list 
  * @param size size to malloc
  * 
  * @return pointer of newly created block or reused block 
  */
-void *malloc(size_t size);
+void *ca_malloc(size_t size);
 
 /**
- * free will free the allocated memory that is requested
+ * ca_free will free the allocated memory that is requested
  * @param ptr requested void pointer to free
  * 
  */
-void free(void *ptr);
+void ca_free(void *ptr);
 
 /**
- * calloc allocates memory like malloc but also initializes all memory to zero
+ * ca_calloc allocates memory like malloc but also initializes all memory to zero
  * @param nmemb number of the certain data type
  * @param size size of the data type. will get multiplied to nmemb before mallocing
  * 
- * @return pointer of new block calloc'd 
+ * @return pointer of new block calloc'd, or NULL if nmemb * size overflows
  */
-void *calloc(size_t nmemb, size_t size);
+void *ca_calloc(size_t nmemb, size_t size);
 
 /**
- * realloc allocates memory like malloc but also resizes if the requested size if bigger. Free's if size is 0 and is unchanged if the size is less than ptr->size
+ * ca_realloc moves the allocation to a block of the requested size, copying over as
+ * much of the old contents as fits. Free's if size is 0
  * @param ptr pointer to resize
  * @param size size to know how size to resize to
  * 
- * @return pointer of new block that was resized, freed or unchanged ptr
+ * @return pointer of new block that was resized, or NULL if it was freed
+ */
+void *ca_realloc(void *ptr, size_t size);
+
+/**
+ * ca_alloc_block is the locked part of ca_malloc, taking the block size precomputed.
+ * When the allocation is sampled, the function it was called from is its site.
+ * @param size size requested by the caller
+ * @param aligned_size block size (header + data) from ca_block_size(), which
+ * is 0 for sizes that overflow
+ *
+ * @return pointer to the data area of the allocated block, or NULL (with
+ * errno ENOMEM if aligned_size is 0)
+ */
+void *ca_alloc_block(size_t size, size_t aligned_size);
+
+/**
+ * ca_free_block is the locked part of ca_free
+ * @param block header of the block to free
+ */
+void ca_free_block(struct mem_block *block);
+
+/*
+ * allocator.so also exports the standard names below as aliases of the ca_
+ * functions so it can be interposed with LD_PRELOAD. liballocator.a only has
+ * the prefixed API and can be linked alongside the C library's allocator.
+ * C++ sees the C library's own declarations of these names instead.
+ */
+#ifndef __cplusplus
+
+/**
+ * malloc allocates memory. Alias of ca_malloc in allocator.so
+ */
+void *malloc(size_t size);
+
+/**
+ * free will free the allocated memory that is requested. Alias of ca_free in allocator.so
+ */
+void free(void *ptr);
+
+/**
+ * calloc allocates zeroed memory. Alias of ca_calloc in allocator.so
+ */
+void *calloc(size_t nmemb, size_t size);
+
+/**
+ * realloc resizes an allocation. Alias of ca_realloc in allocator.so
  */
 void *realloc(void *ptr, size_t size);
+#endif
+
+/*
+ * The helpers keep their original names in allocator.so too. They are
+ * generic enough to clash with other code, so liballocator.a only has the
+ * ca_ versions.
+ */
+struct mem_block *split_block(struct mem_block *block, size_t size); /*!< Alias of ca_split_block */
+struct mem_block *merge_block(struct mem_block *block); /*!< Alias of ca_merge_block */
+void *reuse(size_t size); /*!< Alias of ca_reuse */
+void *first_fit(size_t size); /*!< Alias of ca_first_fit */
+void *worst_fit(size_t size); /*!< Alias of ca_worst_fit */
+void *best_fit(size_t size); /*!< Alias of ca_best_fit */
+void *malloc_name(size_t size, char *name); /*!< Alias of ca_malloc_name */
+void print_memory(void); /*!< Alias of ca_print_memory */
+void print_stats(void); /*!< Alias of ca_print_stats */
+
+/* -- Tagged allocation -- */
+/**
+ * alloc_tag_set sets the calling thread's current tag. Until it is changed,
+ * every allocation the thread makes, including those made by libraries
+ * through plain malloc, carries the tag as its name and is placed in regions
+ * that hold only blocks with that tag.
+ * @param tag tag name (at most 31 characters are kept), or NULL for none
+ *
+ * @return the previous tag, or NULL if there was none, so scopes can nest
+ */
+const char *alloc_tag_set(const char *tag);
+
+/**
+ * free_all_tagged releases every allocation carrying `tag`, in all threads,
+ * by unmapping the tag's regions whole. Blocks are not visited one by one,
+ * so they are not counted as frees by the accounting, lifetime or route
+ * statistics or recorded in the trace, and nothing checks whether they are
+ * still in use.
+ * @param tag tag given to alloc_tag_set (NULL releases nothing)
+ *
+ * @return bytes of regions released
+ */
+size_t free_all_tagged(const char *tag);
+
+/* -- Heap walking -- */
+/**
+ * allocator_disable blocks every allocation and free, in all threads, until
+ * allocator_enable is called. The heap can then be walked with
+ * allocator_iterate. Like bionic's malloc_disable.
+ */
+void allocator_disable(void);
+
+/**
+ * allocator_enable lets allocations and frees proceed again after
+ * allocator_disable. Must be called by the thread that disabled the allocator.
+ */
+void allocator_enable(void);
+
+/**
+ * allocator_iterate calls `callback` for every live allocation that overlaps
+ * [base, base + size), with the allocation's address and usable size, like
+ * bionic's malloc_iterate. It must be called between allocator_disable and
+ * allocator_enable. The walk allocates nothing and skips regions with no
+ * live blocks without looking at them; the callback must not allocate or
+ * free either.
+ * @param base start of the address range to walk
+ * @param size length of the range (use UINTPTR_MAX with base 0 for all)
+ * @param callback called as callback(address, size, arg) for each allocation
+ * @param arg passed through to the callback
+ *
+ * @return 0
+ */
+int allocator_iterate(uintptr_t base, size_t size,
+        void (*callback)(uintptr_t base, size_t size, void *arg), void *arg);
+
+/**
+ * allocator_block_of finds the live allocation containing `ptr`, which may
+ * point anywhere inside its usable area, for conservative scanners and debug
+ * tools. The region is found by binary search in the region directory, and
+ * the block through a per-page index of the region, built on first use.
+ * Merges update the entries that named the absorbed block, and the index is
+ * rebuilt only when its region grows. It takes the allocator lock, so it is
+ * safe to call while other threads allocate, and it may also be called
+ * between allocator_disable and allocator_enable by the disabling thread.
+ * @param ptr address to look up
+ * @param base set to the allocation's address
+ * @param size set to the allocation's usable size
+ *
+ * @return 0 if `ptr` is inside a live allocation, -1 otherwise
+ */
+int allocator_block_of(const void *ptr, uintptr_t *base, size_t *size);
+
+/* -- Heap snapshots -- */
+/**
+ * heap_snapshot_take records live bytes per tag (blocks named with
+ * malloc_name or alloc_tag_set) and per sampled call site (see
+ * ALLOCATOR_SAMPLE). Individual blocks are not recorded, so snapshots are
+ * cheap to keep around.
+ *
+ * @return the snapshot, or NULL if it could not be mapped
+ */
+struct heap_snapshot *heap_snapshot_take(void);
+
+/**
+ * heap_snapshot_diff prints the tags and sampled sites whose live bytes grew
+ * between two snapshots, largest growth first
+ * @param a the earlier snapshot
+ * @param b the later snapshot
+ *
+ * @return number of tags and sites that grew
+ */
+unsigned int heap_snapshot_diff(const struct heap_snapshot *a, const struct heap_snapshot *b);
+
+/**
+ * heap_snapshot_free releases a snapshot from heap_snapshot_take
+ * @param snapshot the snapshot to release
+ */
+void heap_snapshot_free(struct heap_snapshot *snapshot);
+
+/**
+ * heap_report_write writes a heap report: region and hugepage stats, a
+ * fragmentation summary, and the largest tags and sampled sites. The same
+ * report is written when the signal configured with ALLOCATOR_REPORT_SIGNAL
+ * arrives.
+ * @param fd file descriptor to write the report to
+ *
+ * @return 0 on success, -1 if the report couldn't be built
+ */
+int heap_report_write(int fd);
 
 /* -- Data Structures -- */
 
+#define BLOCK_NAMED 0x01 /*!< Block has a name, from malloc_name or alloc_tag_set */
+#define BLOCK_SAMPLED 0x02 /*!< Block's call site was sampled */
+
 /**
  * Defines metadata structure for both memory 'regions' and 'blocks.' This
  * structure is prefixed before each allocation's data area.
@@ -129,6 +436,8 @@ void *realloc(void *ptr, size_t size);
  * @var region_id The region of each memory block. Each region was mmap'd when there were no more reusable memory in the previous region
  * @var next points to the next block in the linked list
  * @var prev points to previous block in linked list since it is doubly linked
+ * @var flags BLOCK_* flags describing the current allocation
+ * @var site return address of the caller for sampled allocations
  * @var padding creates filler space so that the header is equal to 100 bytes
  * 
  */
@@ -157,6 +466,21 @@ struct mem_block {
     /** Previous block in the chain */
     struct mem_block *prev;
 
+    /** BLOCK_* flags, reset on every allocation */
+    unsigned char flags;
+
+    /** Call site of a sampled allocation (BLOCK_SAMPLED), otherwise 0 */
+    uintptr_t site;
+
+    /** Allocation clock when the block was allocated, for lifetime stats */
+    uint64_t birth;
+
+    /** Tag of the block's region (see alloc_tag_set), 0 if untagged */
+    uint16_t tag;
+
+    /** Heap owning the block's region (ALLOCATOR_HEAPS), 0 for the global pool */
+    uint16_t heap;
+
     /**
      * "Padding" to make the total size of this struct 100 bytes. This serves no
      * purpose other than to make memory address calculations easier. If you
@@ -164,7 +488,99 @@ struct mem_block {
      * and keep the total size at 100 bytes; test cases and tooling will assume
      * a 100-byte header.
      */
-    char padding[35];
+    char padding[10];
+
+    /**
+     * Reference count of an rc_alloc block. Kept last, right before the data,
+     * so it is 4-byte aligned (headers start 8-byte aligned) and shares a
+     * cache line with the start of the object.
+     */
+    uint32_t refs;
 } __attribute__((packed));
 
+/**
+ * @struct allocator_stats snapshot of allocator-wide statistics
+ * @var regions number of regions currently mapped
+ * @var region_bytes total size of all mapped regions
+ * @var hugepages number of 2 MB hugepages held by the hugepage filler
+ * @var hugepage_region_bytes region bytes carved out of filler hugepages.
+ * Dividing by region_bytes gives the hugepage coverage of the heap.
+ * @var extend_attempts times a region was grown in place with mremap instead
+ * of mapping a new one, successfully or not
+ * @var extend_successes in-place growths that succeeded
+ * @var near_requests malloc_near calls whose hint was a live allocation
+ * @var near_hits malloc_near calls served from a free block near the hint
+ * @var warm_hits allocations placed in the region the thread last freed
+ * into (ALLOCATOR_WARM)
+ * @var file_regions regions in the file-backed overflow tier. They are
+ * included in regions as well.
+ * @var file_bytes bytes in those regions, included in region_bytes
+ * @var heap_releases regions a thread heap gave up to the global pool for
+ * being too empty (ALLOCATOR_HEAPS)
+ * @var heap_adoptions regions a thread heap took over from the global pool
+ */
+struct allocator_stats {
+    unsigned long regions;
+    size_t region_bytes;
+    unsigned long hugepages;
+    size_t hugepage_region_bytes;
+    unsigned long extend_attempts;
+    unsigned long extend_successes;
+    unsigned long near_requests;
+    unsigned long near_hits;
+    unsigned long warm_hits;
+    unsigned long file_regions;
+    size_t file_bytes;
+    unsigned long heap_releases;
+    unsigned long heap_adoptions;
+};
+
+/**
+ * @struct allocator_route_stats counters for one size range
+ * @var limit largest usable size in the range (SIZE_MAX for the last one)
+ * @var engine name of the range's engine ("algorithm" when it uses the
+ * configured ALLOCATOR_ALGORITHM)
+ * @var allocations allocations made in the range
+ * @var frees allocations in the range freed
+ * @var live_bytes usable bytes currently allocated in the range
+ */
+struct allocator_route_stats {
+    size_t limit;
+    const char *engine;
+    unsigned long allocations;
+    unsigned long frees;
+    size_t live_bytes;
+};
+
+#define CA_LIFETIME_CLASSES 8 /*!< Size classes: <= 64 B, <= 256 B, ... <= 256 KB, larger */
+#define CA_LIFETIME_BUCKETS 32 /*!< log2 lifetime buckets */
+
+/**
+ * @struct allocator_lifetimes how long freed allocations lived, measured in
+ * allocations made by the whole process in the meantime. Class c holds
+ * usable sizes up to 64 << (2 * c) bytes, the last class everything larger.
+ * Bucket 0 counts lifetimes of 0, bucket b lifetimes in [2^(b-1), 2^b), and
+ * the last bucket everything longer.
+ * @var freed freed allocations per size class and lifetime bucket
+ */
+struct allocator_lifetimes {
+    uint64_t freed[CA_LIFETIME_CLASSES][CA_LIFETIME_BUCKETS];
+};
+
+/**
+ * @struct alloc_scope per-thread byte counts for a scope. Between
+ * alloc_scope_begin and alloc_scope_end it holds the starting counter values;
+ * afterwards it holds the deltas.
+ * @var allocated bytes allocated (usable size)
+ * @var deallocated bytes freed (usable size)
+ */
+struct alloc_scope {
+    uint64_t allocated;
+    uint64_t deallocated;
+};
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
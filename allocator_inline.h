@@ -0,0 +1,68 @@
+/**
+ * @file
+ *
+ * Inlinable fast path for programs linked against liballocator.a. The block
+ * size computation and the NULL checks happen at the call site, where the
+ * compiler can constant-fold them; only the locked list update is a call.
+ * Building with -flto lets that call be inlined as well.
+ */
+
+#ifndef ALLOCATOR_INLINE_H
+#define ALLOCATOR_INLINE_H
+
+#include "allocator.h"
+
+#define CA_ALIGN_SIZE 8 /*!< Alignment of every block (header + data) */
+
+/**
+ * ca_block_size computes the aligned block size (header + data) that an
+ * allocation of `size` bytes occupies
+ * @param size requested allocation size
+ *
+ * @return block size, rounded up to CA_ALIGN_SIZE, or 0 if it would exceed
+ * PTRDIFF_MAX, like glibc's limit, so that rounding it to pages can't wrap
+ */
+static inline size_t ca_block_size(size_t size)
+{
+    if (size > PTRDIFF_MAX - sizeof(struct mem_block) - CA_ALIGN_SIZE) {
+        return 0;
+    }
+    return (size + sizeof(struct mem_block) + CA_ALIGN_SIZE - 1) & ~(size_t) (CA_ALIGN_SIZE - 1);
+}
+
+/**
+ * ca_malloc_inline is ca_malloc with the size computation done inline. A
+ * size too large for a block gets NULL from ca_alloc_block, and sampled
+ * allocations record the caller as their site.
+ * @param size size to malloc
+ *
+ * @return pointer to the allocation or NULL
+ */
+static inline void *ca_malloc_inline(size_t size)
+{
+    return ca_alloc_block(size, ca_block_size(size));
+}
+
+/**
+ * ca_free_inline is ca_free with the NULL check done inline
+ * @param ptr pointer to free
+ */
+static inline void ca_free_inline(void *ptr)
+{
+    if (ptr != NULL) {
+        ca_free_block((struct mem_block *) ptr - 1);
+    }
+}
+
+/**
+ * ca_usable_size reads the usable size of an allocation from its header
+ * @param ptr pointer returned by one of the ca_ allocation functions
+ *
+ * @return number of usable bytes, which may exceed the requested size
+ */
+static inline size_t ca_usable_size(const void *ptr)
+{
+    return ((const struct mem_block *) ptr - 1)->size - sizeof(struct mem_block);
+}
+
+#endif
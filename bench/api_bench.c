@@ -0,0 +1,60 @@
+/**
+ * @file
+ *
+ * Measures the cost of malloc/free pairs over a small random working set.
+ * Built twice: bench/api_bench calls plain malloc/free and is meant to run
+ * under LD_PRELOAD=allocator.so (interposed through the PLT), while
+ * bench/api_bench_direct is statically linked against liballocator.a with
+ * LTO and calls the inlinable ca_ fast path directly.
+ *
+ * Usage: api_bench [operations] [working set]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef BENCH_DIRECT
+#include "../allocator_inline.h"
+#define bench_malloc(sz) ca_malloc_inline(sz)
+#define bench_free(ptr) ca_free_inline(ptr)
+#define BENCH_NAME "direct (liballocator.a)"
+#else
+#define bench_malloc(sz) malloc(sz)
+#define bench_free(ptr) free(ptr)
+#define BENCH_NAME "interposed (malloc)"
+#endif
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    long ops = argc > 1 ? atol(argv[1]) : 2000000;
+    int live = argc > 2 ? atoi(argv[2]) : 64;
+    void **slots = bench_malloc(live * sizeof(void *));
+    for (int i = 0; i < live; i++) {
+        slots[i] = NULL;
+    }
+
+    unsigned int seed = 42;
+    double start = now();
+    for (long i = 0; i < ops; i++) {
+        seed = seed * 1103515245 + 12345;
+        int slot = (seed >> 8) % live;
+        bench_free(slots[slot]);
+        slots[slot] = bench_malloc(16 + (seed >> 16) % 240);
+    }
+    double elapsed = now() - start;
+
+    for (int i = 0; i < live; i++) {
+        bench_free(slots[i]);
+    }
+    bench_free(slots);
+    printf("%-26s %8.1f ns per malloc/free pair\n", BENCH_NAME, elapsed * 1e9 / ops);
+    return 0;
+}
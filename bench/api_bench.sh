@@ -0,0 +1,9 @@
+#!/usr/bin/env bash
+# Compares direct calls into liballocator.a against the LD_PRELOAD path.
+# Run from the repository root after 'make bench LOGGER=0'.
+
+set -e
+root="$(cd "$(dirname "$0")/.." && pwd)"
+
+LD_PRELOAD="${root}/allocator.so" "${root}/bench/api_bench" "$@"
+"${root}/bench/api_bench_direct" "$@"
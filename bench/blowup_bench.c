@@ -0,0 +1,148 @@
+/**
+ * @file
+ *
+ * The producer/consumer pattern that blows up per-thread heaps. Threads take
+ * turns: each round one thread allocates a batch of objects and the next
+ * thread frees them, except one in eight, which lives on for a full cycle of
+ * rounds. The producer changes every round, so the memory a consumer frees
+ * sits in regions owned by a heap that won't allocate again for a while.
+ * Unless sparse regions go back to a shared pool, every thread's heap ends
+ * up holding enough regions for the whole workload.
+ *
+ * Reports peak region bytes against peak live bytes. Run through
+ * bench/blowup_bench.sh, which compares the single shared heap, thread
+ * heaps without the emptiness invariant, and thread heaps with it.
+ *
+ * Usage: blowup_bench [threads] [rounds] [objects per batch]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../allocator.h"
+
+#define MAX_THREADS 16
+#define KEEP_EVERY 8
+
+static int threads;
+static long rounds;
+static long batch_size;
+
+struct object {
+    char *ptr;
+    size_t size;
+};
+
+static pthread_barrier_t barrier;
+static struct object *batch;
+static struct object *survivors[MAX_THREADS];
+static long num_survivors[MAX_THREADS];
+
+static size_t live_bytes;
+static size_t peak_live;
+static size_t peak_mapped;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Only ever called by one thread at a time, between barriers */
+static void sample(void)
+{
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    if (stats.region_bytes > peak_mapped) {
+        peak_mapped = stats.region_bytes;
+    }
+    if (live_bytes > peak_live) {
+        peak_live = live_bytes;
+    }
+}
+
+static void produce(unsigned int *seed)
+{
+    for (long i = 0; i < batch_size; i++) {
+        batch[i].size = 16 + rand_r(seed) % 512;
+        batch[i].ptr = malloc(batch[i].size);
+        batch[i].ptr[0] = (char) i;
+        live_bytes += batch[i].size;
+    }
+    sample();
+}
+
+static void consume(long round)
+{
+    /* Survivors kept this many rounds ago are now freed too */
+    int slot = round % threads;
+    for (long i = 0; i < num_survivors[slot]; i++) {
+        free(survivors[slot][i].ptr);
+        live_bytes -= survivors[slot][i].size;
+    }
+    num_survivors[slot] = 0;
+
+    for (long i = 0; i < batch_size; i++) {
+        if (i % KEEP_EVERY == 0) {
+            survivors[slot][num_survivors[slot]++] = batch[i];
+        } else {
+            free(batch[i].ptr);
+            live_bytes -= batch[i].size;
+        }
+    }
+    sample();
+}
+
+static void *run(void *arg)
+{
+    int id = (int) (long) arg;
+    unsigned int seed = id + 1;
+    for (long round = 0; round < rounds; round++) {
+        if (round % threads == id) {
+            produce(&seed);
+        }
+        pthread_barrier_wait(&barrier);
+        if ((round + 1) % threads == id) {
+            consume(round);
+        }
+        pthread_barrier_wait(&barrier);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    threads = argc > 1 ? atoi(argv[1]) : 4;
+    rounds = argc > 2 ? atol(argv[2]) : 40;
+    batch_size = argc > 3 ? atol(argv[3]) : 5000;
+    if (threads < 2 || threads > MAX_THREADS) {
+        fprintf(stderr, "threads must be between 2 and %d\n", MAX_THREADS);
+        return 1;
+    }
+
+    batch = malloc(batch_size * sizeof(struct object));
+    for (int i = 0; i < threads; i++) {
+        survivors[i] = malloc((batch_size / KEEP_EVERY + 1) * sizeof(struct object));
+    }
+
+    pthread_barrier_init(&barrier, NULL, threads);
+    pthread_t tids[MAX_THREADS];
+    double start = now();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, run, (void *) (long) i);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    double elapsed = now() - start;
+
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    printf("%10.3f %14.1f %14.1f %8.2f %10lu %10lu\n", elapsed, peak_mapped / 1048576.0,
+            peak_live / 1048576.0, (double) peak_mapped / peak_live,
+            stats.heap_releases, stats.heap_adoptions);
+    return 0;
+}
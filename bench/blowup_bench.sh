@@ -0,0 +1,15 @@
+#!/usr/bin/env bash
+# Runs bench/blowup_bench with one shared heap, with thread heaps but no
+# emptiness invariant (ALLOCATOR_EMPTINESS=100), and with thread heaps and
+# the default invariant. Run from the repository root after
+# 'make bench LOGGER=0'.
+
+set -e
+root="$(cd "$(dirname "$0")/.." && pwd)"
+
+printf '%-16s %10s %14s %14s %8s %10s %10s\n' heaps seconds "peak mapped MB" "peak live MB" blowup released adopted
+for variant in "shared:0:25" "thread:1:100" "thread+pool:1:25"; do
+    IFS=':' read -r name heaps emptiness <<< "${variant}"
+    printf '%-16s ' "${name}"
+    ALLOCATOR_HEAPS="${heaps}" ALLOCATOR_EMPTINESS="${emptiness}" "${root}/bench/blowup_bench" "$@"
+done
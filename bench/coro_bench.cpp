@@ -0,0 +1,259 @@
+/**
+ * @file
+ *
+ * Echo server written with C++20 coroutines, run once with coroutine frames
+ * from the global operator new and once with frames from coro_alloc.hpp.
+ * Linked against allocator.so, so the global operator new lands in the
+ * allocator's block list either way.
+ *
+ * Clients and server share one thread and one poll loop over socketpairs.
+ * Each message costs three coroutine frames: the server's handler, the
+ * transform it awaits, and the client's round trip.
+ *
+ * Usage: coro_bench [connections] [messages per connection]
+ */
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include "../coro_alloc.hpp"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Promise base that leaves frame allocation to the global operator new */
+struct global_allocated {
+};
+
+template <typename Base>
+class task {
+public:
+    struct promise_type : Base {
+        std::coroutine_handle<> continuation = std::noop_coroutine();
+
+        task get_return_object()
+        {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct final_awaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                return h.promise().continuation;
+            }
+            void await_resume() noexcept {}
+        };
+
+        final_awaiter final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    explicit task(std::coroutine_handle<promise_type> h) : handle(h) {}
+    task(task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+    task(const task &) = delete;
+    ~task()
+    {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller)
+    {
+        handle.promise().continuation = caller;
+        return handle;
+    }
+    void await_resume() {}
+
+    void start() { handle.resume(); }
+    bool done() const { return handle.done(); }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+/* Coroutines waiting for their descriptor to become readable */
+class event_loop {
+public:
+    struct readable {
+        event_loop &loop;
+        int fd;
+
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> h) { loop.waiting.push_back({fd, h}); }
+        void await_resume() {}
+    };
+
+    readable wait(int fd) { return readable{*this, fd}; }
+
+    void run()
+    {
+        std::vector<struct pollfd> fds;
+        std::vector<std::pair<int, std::coroutine_handle<>>> ready;
+        while (!waiting.empty()) {
+            fds.clear();
+            for (auto &w : waiting) {
+                fds.push_back({w.first, POLLIN, 0});
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                perror("poll");
+                exit(1);
+            }
+
+            ready.clear();
+            std::vector<std::pair<int, std::coroutine_handle<>>> still;
+            for (size_t i = 0; i < fds.size(); i++) {
+                if (fds[i].revents != 0) {
+                    ready.push_back(waiting[i]);
+                } else {
+                    still.push_back(waiting[i]);
+                }
+            }
+            waiting.swap(still);
+            for (auto &r : ready) {
+                r.second.resume();
+            }
+        }
+    }
+
+private:
+    std::vector<std::pair<int, std::coroutine_handle<>>> waiting;
+};
+
+template <typename Base>
+static task<Base> transform(char *buf, ssize_t len)
+{
+    for (ssize_t i = 0; i < len; i++) {
+        buf[i] = toupper((unsigned char) buf[i]);
+    }
+    co_return;
+}
+
+template <typename Base>
+static task<Base> handle_message(event_loop &loop, int fd, bool *closed)
+{
+    char buf[128];
+    co_await loop.wait(fd);
+    ssize_t len = read(fd, buf, sizeof(buf));
+    if (len <= 0) {
+        *closed = true;
+        co_return;
+    }
+    co_await transform<Base>(buf, len);
+    if (write(fd, buf, len) != len) {
+        perror("write");
+        exit(1);
+    }
+}
+
+template <typename Base>
+static task<Base> server(event_loop &loop, int fd)
+{
+    bool closed = false;
+    while (!closed) {
+        co_await handle_message<Base>(loop, fd, &closed);
+    }
+}
+
+template <typename Base>
+static task<Base> round_trip(event_loop &loop, int fd, long n)
+{
+    char msg[64];
+    char reply[64];
+    int len = snprintf(msg, sizeof(msg), "message %ld", n);
+    if (write(fd, msg, len) != len) {
+        perror("write");
+        exit(1);
+    }
+    co_await loop.wait(fd);
+    if (read(fd, reply, sizeof(reply)) != len) {
+        perror("read");
+        exit(1);
+    }
+}
+
+template <typename Base>
+static task<Base> client(event_loop &loop, int fd, long messages)
+{
+    for (long n = 0; n < messages; n++) {
+        co_await round_trip<Base>(loop, fd, n);
+    }
+    shutdown(fd, SHUT_WR);
+}
+
+template <typename Base>
+static double run(int connections, long messages)
+{
+    event_loop loop;
+    std::vector<task<Base>> tasks;
+    std::vector<int> fds;
+
+    for (int i = 0; i < connections; i++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+            perror("socketpair");
+            exit(1);
+        }
+        fds.push_back(sv[0]);
+        fds.push_back(sv[1]);
+        tasks.push_back(server<Base>(loop, sv[0]));
+        tasks.push_back(client<Base>(loop, sv[1], messages));
+    }
+
+    double start = now();
+    for (auto &t : tasks) {
+        t.start();
+    }
+    loop.run();
+    double elapsed = now() - start;
+
+    for (auto &t : tasks) {
+        if (!t.done()) {
+            fprintf(stderr, "coroutine did not finish\n");
+            exit(1);
+        }
+    }
+    for (int fd : fds) {
+        close(fd);
+    }
+    return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    int connections = argc > 1 ? atoi(argv[1]) : 16;
+    long messages = argc > 2 ? atol(argv[2]) : 20000;
+    double frames = 3.0 * connections * messages;
+
+    /* Warm up both paths so neither pays for the first regions */
+    run<global_allocated>(connections, messages / 10 + 1);
+    run<ca::frame_allocated>(connections, messages / 10 + 1);
+
+    double global = run<global_allocated>(connections, messages);
+    double pooled = run<ca::frame_allocated>(connections, messages);
+
+    printf("%-22s %10s %14s\n", "frames from", "seconds", "ns/frame");
+    printf("%-22s %10.3f %14.1f\n", "operator new", global, global / frames * 1e9);
+    printf("%-22s %10.3f %14.1f\n", "coro_alloc.hpp pool", pooled, pooled / frames * 1e9);
+    return 0;
+}
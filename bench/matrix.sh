@@ -0,0 +1,108 @@
+#!/usr/bin/env bash
+# Runs every bench/matrix_bench workload under each allocator and each
+# ALLOCATOR_CONF variant, and prints one comparison table per workload:
+# throughput, p50/p99/p99.9 latency of a free+malloc pair, and peak RSS.
+#
+#   bench/matrix.sh [-c conf]... [-w workload]... [allocator]...
+#
+# An allocator is a path to a shared object, or one of the names glibc (no
+# preload), jemalloc, tcmalloc or mimalloc, which are looked up in the usual
+# library directories. Allocators that can't be found are skipped with a
+# note. Default: glibc allocator.so jemalloc tcmalloc mimalloc.
+#
+# Each -c adds an ALLOCATOR_CONF variant (e.g. -c algorithm:best_fit); the
+# variants only apply to this allocator's builds (allocator*.so). '-c ""'
+# runs the defaults alongside them. Each -w picks a workload (small, mixed,
+# large, threads; default all). OPS sets operations per thread (default
+# 200000). Run from the repository root after 'make bench LOGGER=0'.
+
+set -e
+root="$(cd "$(dirname "$0")/.." && pwd)"
+ops="${OPS:-200000}"
+confs=()
+workloads=()
+
+while getopts "c:w:" opt; do
+    case "${opt}" in
+        c) confs+=("${OPTARG}") ;;
+        w) workloads+=("${OPTARG}") ;;
+        *) exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+allocators=("$@")
+if [ ${#allocators[@]} -eq 0 ]; then
+    allocators=(glibc "${root}/allocator.so" jemalloc tcmalloc mimalloc)
+fi
+if [ ${#confs[@]} -eq 0 ]; then
+    confs=("")
+fi
+if [ ${#workloads[@]} -eq 0 ]; then
+    workloads=(small mixed large threads)
+fi
+
+# Prints the path of an installed allocator, or nothing
+find_library() {
+    local names
+    case "$1" in
+        jemalloc) names="libjemalloc.so.2 libjemalloc.so" ;;
+        tcmalloc) names="libtcmalloc_minimal.so.4 libtcmalloc.so.4 libtcmalloc_minimal.so libtcmalloc.so" ;;
+        mimalloc) names="libmimalloc.so.2 libmimalloc.so" ;;
+        *)
+            if [ -f "$1" ]; then
+                realpath "$1"
+            fi
+            return
+            ;;
+    esac
+    for dir in /usr/lib/x86_64-linux-gnu /usr/lib/aarch64-linux-gnu /usr/lib64 /usr/lib \
+            /usr/local/lib /usr/local/lib64; do
+        for name in ${names}; do
+            if [ -f "${dir}/${name}" ]; then
+                echo "${dir}/${name}"
+                return
+            fi
+        done
+    done
+}
+
+# Each run is "label|preload|conf"
+runs=()
+for allocator in "${allocators[@]}"; do
+    if [ "${allocator}" = glibc ]; then
+        runs+=("glibc||")
+        continue
+    fi
+    lib="$(find_library "${allocator}")"
+    if [ -z "${lib}" ]; then
+        echo "skipping ${allocator}: not installed" >&2
+        continue
+    fi
+    name="$(basename "${lib}")"
+    case "${name}" in
+        allocator*.so)
+            for conf in "${confs[@]}"; do
+                runs+=("${name}${conf:+ ${conf}}|${lib}|${conf}")
+            done
+            ;;
+        *) runs+=("${name}|${lib}|") ;;
+    esac
+done
+
+for workload in "${workloads[@]}"; do
+    printf '\n%s (%s ops per thread)\n' "${workload}" "${ops}"
+    printf '%-40s %12s %10s %10s %10s %10s\n' allocator "ops/s" "p50 ns" "p99 ns" "p99.9 ns" "RSS MB"
+    for run in "${runs[@]}"; do
+        IFS='|' read -r label lib conf <<< "${run}"
+        if [ -n "${conf}" ]; then
+            result="$(ALLOCATOR_CONF="${conf}" LD_PRELOAD="${lib}" \
+                "${root}/bench/matrix_bench" "${workload}" "${ops}")"
+        else
+            result="$(LD_PRELOAD="${lib}" "${root}/bench/matrix_bench" "${workload}" "${ops}")"
+        fi
+        read -r throughput p50 p99 p999 rss <<< "${result}"
+        printf '%-40s %12s %10s %10s %10s %10.1f\n' "${label}" "${throughput}" "${p50}" \
+            "${p99}" "${p999}" "$(awk "BEGIN { print ${rss} / 1024 }")"
+    done
+done
@@ -0,0 +1,192 @@
+/**
+ * @file
+ *
+ * Allocator-neutral workloads for bench/matrix.sh. Only malloc and free are
+ * called, so the same binary can run under any allocator through LD_PRELOAD
+ * (or under glibc with no preload at all).
+ *
+ * Each thread keeps a working set of live objects and replaces a random one
+ * per operation: free the old object, malloc the new one and write to it.
+ * Every operation is timed on its own and goes into a log-linear histogram,
+ * so latency percentiles cost no allocation while the workload runs.
+ *
+ * Prints one line: operations per second, p50, p99 and p99.9 latency in
+ * nanoseconds, and the peak resident set size in KB.
+ *
+ * Usage: matrix_bench <small|mixed|large|threads> [operations per thread]
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define WORKING_SET 4096
+#define MAX_THREADS 4
+
+/* 32 linear buckets, then 32 per power of two */
+#define SUB_BITS 5
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define BUCKETS (SUB_BUCKETS * 40)
+
+struct workload {
+    const char *name;
+    size_t min_size;
+    size_t max_size;
+    int threads;
+};
+
+static const struct workload workloads[] = {
+    { "small", 16, 256, 1 },
+    { "mixed", 16, 64 * 1024, 1 },
+    { "large", 64 * 1024, 1024 * 1024, 1 },
+    { "threads", 16, 256, MAX_THREADS },
+};
+
+struct worker {
+    const struct workload *workload;
+    long ops;
+    unsigned int seed;
+    uint64_t histogram[BUCKETS];
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bucket_of(uint64_t ns)
+{
+    if (ns < SUB_BUCKETS) {
+        return ns;
+    }
+    int shift = 63 - __builtin_clzll(ns) - SUB_BITS;
+    int bucket = SUB_BUCKETS * (shift + 1) + ((ns >> shift) & (SUB_BUCKETS - 1));
+    return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+/* Lower bound of the latencies that fall into a bucket */
+static uint64_t bucket_value(int bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = bucket / SUB_BUCKETS - 1;
+    return (uint64_t) (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+}
+
+static uint64_t percentile(const uint64_t *histogram, uint64_t total, double p)
+{
+    uint64_t rank = total * p;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen > rank) {
+            return bucket_value(i);
+        }
+    }
+    return bucket_value(BUCKETS - 1);
+}
+
+/* Sizes are spread evenly over log2, so small objects dominate by count */
+static size_t pick_size(const struct workload *w, unsigned int *seed)
+{
+    if (w->min_size == w->max_size) {
+        return w->min_size;
+    }
+    double lo = log2(w->min_size);
+    double hi = log2(w->max_size);
+    double r = rand_r(seed) / (double) RAND_MAX;
+    return (size_t) exp2(lo + (hi - lo) * r);
+}
+
+static void *run_worker(void *arg)
+{
+    struct worker *worker = arg;
+    const struct workload *w = worker->workload;
+    char **slots = calloc(WORKING_SET, sizeof(char *));
+    if (slots == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    for (long i = 0; i < worker->ops; i++) {
+        int slot = rand_r(&worker->seed) % WORKING_SET;
+        size_t size = pick_size(w, &worker->seed);
+        uint64_t start = now_ns();
+        free(slots[slot]);
+        slots[slot] = malloc(size);
+        if (slots[slot] == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        /* Touch the first and last byte so the pages are really resident */
+        slots[slot][0] = (char) i;
+        slots[slot][size - 1] = (char) i;
+        worker->histogram[bucket_of(now_ns() - start)]++;
+    }
+
+    for (int i = 0; i < WORKING_SET; i++) {
+        free(slots[i]);
+    }
+    free(slots);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    const struct workload *w = NULL;
+    for (size_t i = 0; argc > 1 && i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        if (strcmp(argv[1], workloads[i].name) == 0) {
+            w = &workloads[i];
+        }
+    }
+    if (w == NULL) {
+        fprintf(stderr, "usage: %s <small|mixed|large|threads> [operations per thread]\n", argv[0]);
+        return 1;
+    }
+    long ops = argc > 2 ? atol(argv[2]) : 1000000;
+
+    static struct worker workers[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    uint64_t start = now_ns();
+    for (int t = 0; t < w->threads; t++) {
+        workers[t].workload = w;
+        workers[t].ops = ops;
+        workers[t].seed = t + 1;
+        if (w->threads == 1) {
+            run_worker(&workers[t]);
+        } else if (pthread_create(&threads[t], NULL, run_worker, &workers[t]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    for (int t = 0; w->threads > 1 && t < w->threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    static uint64_t histogram[BUCKETS];
+    uint64_t total = 0;
+    for (int t = 0; t < w->threads; t++) {
+        for (int i = 0; i < BUCKETS; i++) {
+            histogram[i] += workers[t].histogram[i];
+            total += workers[t].histogram[i];
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%.0f %lu %lu %lu %ld\n", total / elapsed,
+            percentile(histogram, total, 0.50),
+            percentile(histogram, total, 0.99),
+            percentile(histogram, total, 0.999),
+            usage.ru_maxrss);
+    return 0;
+}
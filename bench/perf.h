@@ -0,0 +1,89 @@
+/**
+ * @file
+ *
+ * Hardware counters for the benchmarks, read through perf_event_open. Where
+ * the kernel doesn't allow a counter (containers, paranoid settings), it
+ * reads as -1 and the benchmarks print n/a for it.
+ */
+
+#ifndef BENCH_PERF_H
+#define BENCH_PERF_H
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+enum perf_counter {
+    PERF_CACHE_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_NUM_COUNTERS,
+};
+
+struct perf_counters {
+    int fd[PERF_NUM_COUNTERS];
+    long long value[PERF_NUM_COUNTERS];
+};
+
+static inline int perf_open(unsigned int type, unsigned long long config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = type;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * perf_start opens and starts every counter the kernel allows
+ */
+static inline void perf_start(struct perf_counters *pc)
+{
+    pc->fd[PERF_CACHE_MISSES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    pc->fd[PERF_DTLB_MISSES] = perf_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        if (pc->fd[i] != -1) {
+            ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/**
+ * perf_stop stops the counters and reads them into pc->value
+ */
+static inline void perf_stop(struct perf_counters *pc)
+{
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        pc->value[i] = -1;
+        if (pc->fd[i] == -1) {
+            continue;
+        }
+        ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(pc->fd[i], &pc->value[i], sizeof(pc->value[i])) != sizeof(pc->value[i])) {
+            pc->value[i] = -1;
+        }
+        close(pc->fd[i]);
+    }
+}
+
+/**
+ * perf_print prints one counter in a column of the given width
+ */
+static inline void perf_print(const struct perf_counters *pc, enum perf_counter counter, int width)
+{
+    if (pc->value[counter] >= 0) {
+        printf(" %*lld", width, pc->value[counter]);
+    } else {
+        printf(" %*s", width, "n/a");
+    }
+}
+
+#endif
@@ -0,0 +1,151 @@
+/**
+ * @file
+ *
+ * Compares reference counting with rc_alloc, which keeps the count in the
+ * block header, against the common pattern of a separately allocated box
+ * holding the count and a pointer to the object. A set of objects is shared
+ * by a larger set of owner slots: each operation drops one slot's reference,
+ * takes a reference to a random object instead and reads the object through
+ * it. With the box every object is two allocations, and reaching the data is
+ * two dependent loads from different blocks.
+ *
+ * Each variant runs in its own child process so both start from an empty
+ * heap. Cache misses are counted with perf_event_open where the kernel
+ * allows it.
+ *
+ * Usage: rc_bench [objects] [operations]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../allocator.h"
+#include "perf.h"
+
+#define OBJECT_SIZE 48
+#define OWNERS_PER_OBJECT 4
+
+struct box {
+    uint32_t refs;
+    void *data;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *object_new(bool embedded)
+{
+    if (embedded) {
+        return rc_alloc(OBJECT_SIZE);
+    }
+    struct box *box = malloc(sizeof(struct box));
+    box->refs = 1;
+    box->data = malloc(OBJECT_SIZE);
+    return box;
+}
+
+static void *object_retain(bool embedded, void *handle)
+{
+    if (embedded) {
+        return rc_retain(handle);
+    }
+    __atomic_fetch_add(&((struct box *) handle)->refs, 1, __ATOMIC_RELAXED);
+    return handle;
+}
+
+static void object_release(bool embedded, void *handle)
+{
+    if (embedded) {
+        rc_release(handle);
+        return;
+    }
+    struct box *box = handle;
+    if (__atomic_sub_fetch(&box->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(box->data);
+        free(box);
+    }
+}
+
+static char *object_data(bool embedded, void *handle)
+{
+    return embedded ? handle : ((struct box *) handle)->data;
+}
+
+static void run(bool embedded, long objects, long ops)
+{
+    srand(1);
+    long num_owners = objects * OWNERS_PER_OBJECT;
+    void **live = malloc(objects * sizeof(void *));
+    void **owners = malloc(num_owners * sizeof(void *));
+
+    double start = now();
+    for (long i = 0; i < objects; i++) {
+        live[i] = object_new(embedded);
+        memset(object_data(embedded, live[i]), (int) i, OBJECT_SIZE);
+    }
+    for (long i = 0; i < num_owners; i++) {
+        owners[i] = object_retain(embedded, live[i % objects]);
+    }
+    double created = now() - start;
+
+    struct perf_counters counters;
+    perf_start(&counters);
+    start = now();
+    unsigned long sum = 0;
+    for (long i = 0; i < ops; i++) {
+        long slot = rand() % num_owners;
+        object_release(embedded, owners[slot]);
+        owners[slot] = object_retain(embedded, live[rand() % objects]);
+        sum += object_data(embedded, owners[slot])[i % OBJECT_SIZE];
+    }
+    double churned = now() - start;
+    perf_stop(&counters);
+
+    start = now();
+    for (long i = 0; i < num_owners; i++) {
+        object_release(embedded, owners[i]);
+    }
+    for (long i = 0; i < objects; i++) {
+        object_release(embedded, live[i]);
+    }
+    double destroyed = now() - start;
+
+    printf("%-16s %12.1f %12.1f %12.1f", embedded ? "rc_alloc" : "separate box",
+            created / objects * 1e9, churned / ops * 1e9, destroyed / objects * 1e9);
+    perf_print(&counters, PERF_CACHE_MISSES, 14);
+    printf("\n");
+    free(owners);
+    free(live);
+    if (sum == 42) {
+        putchar('\n');
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    long objects = argc > 1 ? atol(argv[1]) : 20000;
+    long ops = argc > 2 ? atol(argv[2]) : 2000000;
+
+    printf("%-16s %12s %12s %12s %14s\n", "counts in", "ns/create", "ns/op", "ns/destroy",
+            "cache misses");
+    fflush(stdout);
+    for (int embedded = 0; embedded <= 1; embedded++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(embedded, objects, ops);
+            exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+#!/usr/bin/env bash
+# Times short-lived programs without LD_PRELOAD and under each allocator
+# given on the command line (default: allocator.so). To see what the
+# bootstrap arena buys, compare against a build with it:
+#
+#   make -B LOGGER=0 BOOTSTRAP_SIZE=262144 && cp allocator.so /tmp/bootstrap.so
+#   make -B LOGGER=0 && bench/startup.sh allocator.so /tmp/bootstrap.so
+#
+# RUNS sets how many times each program is run (default 200).
+
+set -e
+root="$(cd "$(dirname "$0")/.." && pwd)"
+runs="${RUNS:-200}"
+libs=("$@")
+if [ ${#libs[@]} -eq 0 ]; then
+    libs=("${root}/allocator.so")
+fi
+
+commands=(
+    "/bin/true"
+    "ls /usr/bin"
+    "cat /etc/passwd"
+    "sort /etc/services"
+    "date"
+)
+
+# Prints the mean wall time of one run in microseconds
+time_runs() {
+    local start end
+    start=$(date +%s%N)
+    for ((i = 0; i < runs; i++)); do
+        "$@" > /dev/null
+    done
+    end=$(date +%s%N)
+    echo $(( (end - start) / runs / 1000 ))
+}
+
+printf '%-20s %12s' command "no preload"
+for lib in "${libs[@]}"; do
+    printf ' %20s' "$(basename "${lib}")"
+done
+printf '   (us per run)\n'
+
+for cmd in "${commands[@]}"; do
+    printf '%-20s %12s' "${cmd}" "$(time_runs ${cmd})"
+    for lib in "${libs[@]}"; do
+        printf ' %20s' "$(LD_PRELOAD="$(realpath "${lib}")" time_runs ${cmd})"
+    done
+    printf '\n'
+done
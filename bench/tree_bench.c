@@ -0,0 +1,119 @@
+/**
+ * @file
+ *
+ * Measures what malloc_near buys a pointer-chasing workload. A binary search
+ * tree is built in a heap with holes left by other allocations, once with every
+ * node from malloc and once with each node placed near its parent with
+ * malloc_near. Random lookups then walk root-to-leaf paths through the tree.
+ * Each build runs in its own child process so both start from the same heap.
+ *
+ * Lookup time is always reported; cache misses are counted with
+ * perf_event_open where the kernel allows it.
+ *
+ * Usage: tree_bench [nodes] [lookups]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../allocator.h"
+#include "perf.h"
+
+struct node {
+    long key;
+    struct node *left;
+    struct node *right;
+    char payload[40];
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct node *insert(struct node *root, long key, bool near)
+{
+    struct node *parent = NULL;
+    struct node **link = &root;
+    while (*link != NULL) {
+        parent = *link;
+        link = key < parent->key ? &parent->left : &parent->right;
+    }
+
+    struct node *node = near && parent != NULL
+        ? malloc_near(parent, sizeof(struct node))
+        : malloc(sizeof(struct node));
+    node->key = key;
+    node->left = NULL;
+    node->right = NULL;
+    *link = node;
+    return root;
+}
+
+static void run(bool near, long nodes, long lookups)
+{
+    srand(1);
+
+    /* Half the tree is built while the rest of the program allocates too.
+     * Those allocations are then freed, leaving holes between the nodes for
+     * the other half of the tree to land in. */
+    long others = nodes / 2;
+    void **other = malloc(others * sizeof(void *));
+    struct node *root = NULL;
+    for (long i = 0; i < others; i++) {
+        root = insert(root, rand(), near);
+        other[i] = malloc(sizeof(struct node) + rand() % 256);
+    }
+    for (long i = 0; i < others; i++) {
+        free(other[i]);
+    }
+    free(other);
+    for (long i = others; i < nodes; i++) {
+        root = insert(root, rand(), near);
+    }
+
+    struct perf_counters counters;
+    perf_start(&counters);
+    double start = now();
+    long depth = 0;
+    srand(2);
+    for (long i = 0; i < lookups; i++) {
+        long key = rand();
+        for (struct node *n = root; n != NULL; n = key < n->key ? n->left : n->right) {
+            depth++;
+        }
+    }
+    double elapsed = now() - start;
+    perf_stop(&counters);
+
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    printf("%-12s %10.3f %12.1f", near ? "malloc_near" : "malloc", elapsed,
+            elapsed / depth * 1e9);
+    perf_print(&counters, PERF_CACHE_MISSES, 14);
+    printf(" %9lu/%lu\n", stats.near_hits, stats.near_requests);
+}
+
+int main(int argc, char *argv[])
+{
+    long nodes = argc > 1 ? atol(argv[1]) : 20000;
+    long lookups = argc > 2 ? atol(argv[2]) : 2000000;
+
+    printf("%-12s %10s %12s %14s %12s\n", "nodes from", "seconds", "ns/visit", "cache misses", "near hits");
+    fflush(stdout);
+    for (int near = 0; near <= 1; near++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(near, nodes, lookups);
+            exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,17 @@
+#!/usr/bin/env bash
+# Runs bench/api_bench under the generic allocator.so (with the engine chosen
+# through ALLOCATOR_ALGORITHM) and under each specialized variant.
+# Run after 'make bench variants LOGGER=0'.
+
+set -e
+root="$(cd "$(dirname "$0")/.." && pwd)"
+
+for variant in firstfit:first_fit bestfit:best_fit worstfit:worst_fit; do
+    name="${variant%%:*}"
+    algo="${variant##*:}"
+    printf '%-10s generic      ' "${algo}"
+    ALLOCATOR_ALGORITHM="${algo}" LD_PRELOAD="${root}/allocator.so" \
+        "${root}/bench/api_bench" "$@"
+    printf '%-10s specialized  ' "${algo}"
+    LD_PRELOAD="${root}/allocator-${name}.so" "${root}/bench/api_bench" "$@"
+done
@@ -0,0 +1,84 @@
+/**
+ * @file
+ *
+ * Measures cache and TLB behavior of placement with and without the warm
+ * region bias (ALLOCATOR_WARM). A large heap is filled and then thinned out,
+ * leaving cold holes throughout it. A small hot set of objects is then
+ * replaced over and over: each iteration frees one, allocates its
+ * replacement, fills it and reads a few others. Without the bias the
+ * replacements land in the first cold hole that fits; with it they stay in
+ * the region that was just freed into.
+ *
+ * Run through bench/warm_bench.sh, which sets ALLOCATOR_WARM for each run.
+ *
+ * Usage: warm_bench [heap objects] [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../allocator.h"
+#include "perf.h"
+
+#define HOT_OBJECTS 64
+#define MIN_SIZE 512
+#define MAX_SIZE 2048
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    long objects = argc > 1 ? atol(argv[1]) : 20000;
+    long iterations = argc > 2 ? atol(argv[2]) : 500000;
+
+    srand(1);
+    char **heap = malloc(objects * sizeof(char *));
+    for (long i = 0; i < objects; i++) {
+        heap[i] = malloc(MIN_SIZE + rand() % (MAX_SIZE - MIN_SIZE));
+    }
+    for (long i = 0; i < objects; i++) {
+        if (rand() % 5 == 0) {
+            free(heap[i]);
+            heap[i] = NULL;
+        }
+    }
+
+    char *hot[HOT_OBJECTS];
+    for (int i = 0; i < HOT_OBJECTS; i++) {
+        hot[i] = malloc(MIN_SIZE);
+    }
+
+    struct perf_counters counters;
+    perf_start(&counters);
+    double start = now();
+    unsigned long sum = 0;
+    for (long i = 0; i < iterations; i++) {
+        int victim = rand() % HOT_OBJECTS;
+        size_t size = MIN_SIZE + rand() % (MAX_SIZE - MIN_SIZE);
+        free(hot[victim]);
+        hot[victim] = malloc(size);
+        memset(hot[victim], (int) i, size);
+        for (int j = 0; j < 8; j++) {
+            sum += hot[rand() % HOT_OBJECTS][j * 64];
+        }
+    }
+    double elapsed = now() - start;
+    perf_stop(&counters);
+
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    const char *warm = getenv("ALLOCATOR_WARM");
+    printf("%-6s %10.3f %12.1f", warm != NULL && warm[0] == '1' ? "on" : "off", elapsed,
+            elapsed / iterations * 1e9);
+    perf_print(&counters, PERF_CACHE_MISSES, 14);
+    perf_print(&counters, PERF_DTLB_MISSES, 14);
+    printf(" %12lu\n", stats.warm_hits);
+    return sum == 42;
+}
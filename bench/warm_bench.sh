@@ -0,0 +1,11 @@
+#!/usr/bin/env bash
+# Runs bench/warm_bench with the warm region bias off and on.
+# Run from the repository root after 'make bench LOGGER=0'.
+
+set -e
+root="$(cd "$(dirname "$0")/.." && pwd)"
+
+printf '%-6s %10s %12s %14s %14s %12s\n' warm seconds ns/iter "cache misses" "dTLB misses" "warm hits"
+for warm in 0 1; do
+    ALLOCATOR_WARM="${warm}" "${root}/bench/warm_bench" "$@"
+done
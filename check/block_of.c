@@ -0,0 +1,94 @@
+/**
+ * @file
+ *
+ * allocator_block_of: interior pointers resolve to their allocation, freed
+ * memory and foreign addresses don't, and both stay true while merges
+ * remove headers that a region's page index was built over.
+ */
+
+#include "check.h"
+
+#define SLOTS 4000
+
+static char *g_ptrs[SLOTS];
+static size_t g_sizes[SLOTS];
+
+/* Whether `ptr` resolves to the allocation starting at `expected` */
+static bool resolves(const char *ptr, const char *expected, size_t size)
+{
+    uintptr_t base;
+    size_t usable;
+    return allocator_block_of(ptr, &base, &usable) == 0
+        && base == (uintptr_t) expected && usable >= size;
+}
+
+static void check_merges(void)
+{
+    /* Large enough that the page index has entries inside each block */
+    char *blocks[8];
+    for (int i = 0; i < 8; i++) {
+        blocks[i] = ca_malloc(10000);
+        CHECK(blocks[i] != NULL);
+    }
+    for (int i = 0; i < 8; i++) {
+        CHECK(resolves(blocks[i] + 9999, blocks[i], 10000));
+    }
+
+    /* Merge 2..5 into one free block, then carve it up differently */
+    ca_free(blocks[3]);
+    ca_free(blocks[5]);
+    ca_free(blocks[4]);
+    ca_free(blocks[2]);
+    uintptr_t base;
+    size_t usable;
+    CHECK(allocator_block_of(blocks[4] + 5000, &base, &usable) == -1);
+
+    char *big = ca_malloc(30000);
+    CHECK(big == blocks[2]);
+    CHECK(resolves(big + 25000, big, 30000));
+    CHECK(resolves(blocks[6] + 1, blocks[6], 10000));
+    ca_free(big);
+    for (int i = 0; i < 8; i++) {
+        if (i < 2 || i > 5) {
+            ca_free(blocks[i]);
+        }
+    }
+}
+
+/* Random traffic, checking a random interior pointer after every step */
+static void check_random(void)
+{
+    srand(1);
+    for (int step = 0; step < 100000; step++) {
+        int i = rand() % SLOTS;
+        if (g_ptrs[i] != NULL) {
+            ca_free(g_ptrs[i]);
+            g_ptrs[i] = NULL;
+        } else {
+            g_sizes[i] = 1 + rand() % (rand() % 8 == 0 ? 40000 : 300);
+            g_ptrs[i] = ca_malloc(g_sizes[i]);
+            CHECK(g_ptrs[i] != NULL);
+        }
+
+        int j = rand() % SLOTS;
+        if (g_ptrs[j] != NULL) {
+            CHECK(resolves(g_ptrs[j] + rand() % g_sizes[j], g_ptrs[j], g_sizes[j]));
+        }
+    }
+    for (int i = 0; i < SLOTS; i++) {
+        ca_free(g_ptrs[i]);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    uintptr_t base;
+    size_t usable;
+    int local = 0;
+    CHECK(allocator_block_of(&local, &base, &usable) == -1);
+
+    check_merges();
+    check_random();
+    return check_done(argv[0]);
+}
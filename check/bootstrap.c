@@ -0,0 +1,69 @@
+/**
+ * @file
+ *
+ * The bootstrap arena, in a build with BOOTSTRAP_SIZE=65536: the first
+ * region is the static arena in .bss, regions that don't fit in it are
+ * mapped, and once all its blocks are freed the arena serves the next new
+ * region again.
+ */
+
+#include "check.h"
+
+#define ARENA (64UL << 10)
+
+extern char __bss_start[], _end[];
+
+static bool in_bss(const void *ptr)
+{
+    return (const char *) ptr >= __bss_start && (const char *) ptr < _end;
+}
+
+static struct allocator_stats stats(void)
+{
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    return stats;
+}
+
+/* Size whose block fills a region of `bytes` exactly */
+static size_t filling(size_t bytes)
+{
+    return bytes - sizeof(struct mem_block);
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    char *first = ca_malloc(1000);
+    CHECK(first != NULL && in_bss(first));
+    CHECK(stats().regions == 1 && stats().region_bytes == ARENA);
+    char *second = ca_malloc(1000);
+    CHECK(in_bss(second));
+
+    /* The arena is taken and too small anyway */
+    char *large = ca_malloc(filling(2 * ARENA));
+    CHECK(large != NULL && !in_bss(large));
+    CHECK(stats().regions == 2);
+
+    /* Emptied, the arena is released but not unmapped */
+    ca_free(first);
+    ca_free(second);
+    CHECK(stats().regions == 1);
+    first[0] = 1;
+
+    /* and is the next new region */
+    char *again = ca_malloc(1000);
+    CHECK(again == first);
+    CHECK(stats().regions == 2 && stats().region_bytes == 3 * ARENA);
+
+    /* A free arena still only takes regions that fit */
+    ca_free(again);
+    char *larger = ca_malloc(filling(3 * ARENA));
+    CHECK(larger != NULL && !in_bss(larger));
+    CHECK(stats().regions == 2);
+
+    ca_free(large);
+    ca_free(larger);
+    CHECK(stats().regions == 0);
+    return check_done(argv[0]);
+}
@@ -0,0 +1,86 @@
+/**
+ * @file
+ *
+ * Helpers shared by the behavior checks in this directory. Each check is a
+ * program built against allocator.c that exits non-zero after reporting the
+ * first expectation that fails. `make check` builds and runs them all.
+ */
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../allocator.h"
+
+/**
+ * CHECK stops the program with the failing expression and its location.
+ */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+/**
+ * check_env makes sure the program runs with the given name, value, name,
+ * value... environment. The control channel is set up before main, and
+ * allocations made before a check starts may already have read the rest,
+ * so when any of them is missing they are set and the program starts over.
+ */
+#define check_env(argv, ...) check_env_((argv), (const char *const[]) { __VA_ARGS__, NULL })
+
+static inline void check_env_(char **argv, const char *const *vars)
+{
+    bool restart = false;
+    for (const char *const *var = vars; var[0] != NULL; var += 2) {
+        const char *current = getenv(var[0]);
+        if (current == NULL || strcmp(current, var[1]) != 0) {
+            setenv(var[0], var[1], 1);
+            restart = true;
+        }
+    }
+    if (restart) {
+        execv("/proc/self/exe", argv);
+        perror("execv");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * check_header returns the header in front of an allocation.
+ */
+static inline struct mem_block *check_header(const void *ptr)
+{
+    return (struct mem_block *) ptr - 1;
+}
+
+/**
+ * check_live tells whether `ptr` is the start of a live allocation.
+ */
+static inline bool check_live(const void *ptr)
+{
+    uintptr_t base;
+    size_t size;
+    return allocator_block_of(ptr, &base, &size) == 0 && base == (uintptr_t) ptr;
+}
+
+/**
+ * check_done reports that every check of the program named `path` passed.
+ *
+ * @return the exit status for main
+ */
+static inline int check_done(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    printf("%s: ok\n", name != NULL ? name + 1 : path);
+    return EXIT_SUCCESS;
+}
+
+#endif
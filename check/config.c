@@ -0,0 +1,50 @@
+/**
+ * @file
+ *
+ * Configuration: ALLOCATOR_CONF and the individual variables are read on
+ * the first allocation, so main can still set them, the individual variable
+ * wins over the same key in ALLOCATOR_CONF, and changes after that have no
+ * effect. A specialized build keeps its compiled-in engine whatever the
+ * environment says.
+ */
+
+#include "check.h"
+
+#define BLOCKS 10
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    setenv("ALLOCATOR_CONF", "algorithm:best_fit,scribble:1", 1);
+    setenv("ALLOCATOR_ALGORITHM", "worst_fit", 1);
+
+    unsigned char *blocks[BLOCKS];
+    for (int i = 0; i < BLOCKS; i++) {
+        blocks[i] = ca_malloc(200);
+        CHECK(blocks[i] != NULL);
+        CHECK(blocks[i][0] == 0xAA && blocks[i][199] == 0xAA);
+    }
+    setenv("ALLOCATOR_CONF", "algorithm:first_fit", 1);
+    unsetenv("ALLOCATOR_ALGORITHM");
+
+    /* first_fit would take the two-block hole, best_fit the one-block hole
+     * and worst_fit the rest of the region after the last block */
+    ca_free(blocks[2]);
+    ca_free(blocks[3]);
+    ca_free(blocks[6]);
+    unsigned char *placed = ca_malloc(200);
+#ifdef ALLOCATOR_ENGINE
+    CHECK(placed == blocks[6]);
+#else
+    CHECK(placed == blocks[BLOCKS - 1] + check_header(blocks[BLOCKS - 1])->size);
+#endif
+    CHECK(placed[0] == 0xAA);
+
+    ca_free(placed);
+    for (int i = 0; i < BLOCKS; i++) {
+        if (i != 2 && i != 3 && i != 6) {
+            ca_free(blocks[i]);
+        }
+    }
+    return check_done(argv[0]);
+}
@@ -0,0 +1,145 @@
+/**
+ * @file
+ *
+ * Runtime changes through the control channel: the channel starts before
+ * main without fixing the rest of the configuration, set applies valid
+ * options, rejects unknown keys and bad values without changing anything, and warm
+ * placement switched off and on again doesn't start from a block that was
+ * merged away in between. Also built with the engine fixed at compile time
+ * (control_best_fit), where setting the algorithm is rejected.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "check.h"
+
+/* Sends one command to this process's own control socket; returns the reply */
+static const char *control(const char *command)
+{
+    static char reply[2048];
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/allocator-check.%d.ctl", getpid());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(fd != -1);
+    CHECK(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    CHECK(write(fd, command, strlen(command)) == (ssize_t) strlen(command));
+    CHECK(write(fd, "\n", 1) == 1);
+    shutdown(fd, SHUT_WR);
+
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(fd, reply + len, sizeof(reply) - 1 - len)) > 0) {
+        len += n;
+    }
+    reply[len] = '\0';
+    close(fd);
+    return reply;
+}
+
+static bool ok(const char *command)
+{
+    return strcmp(control(command), "OK\n") == 0;
+}
+
+static bool rejected(const char *command)
+{
+    return strncmp(control(command), "ERR", 3) == 0;
+}
+
+/* Whether the stats reply has the line "name value" */
+static bool setting(const char *line)
+{
+    const char *stats = control("stats");
+    size_t len = strlen(line);
+    for (const char *at = stats; (at = strstr(at, line)) != NULL; at++) {
+        if ((at == stats || at[-1] == '\n') && at[len] == '\n') {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool overlaps(const char *a, size_t a_size, const char *b, size_t b_size)
+{
+    return a < b + b_size && b < a + a_size;
+}
+
+static void check_warm_toggle(void)
+{
+    char *a = ca_malloc(100);
+    char *b = ca_malloc(100);
+    char *c = ca_malloc(100);
+    ca_free(b); /* b becomes its region's warm block */
+
+    CHECK(ok("set warm:0"));
+    ca_free(a); /* absorbs b's header */
+    char *d = ca_malloc(250);
+    CHECK(d == a);
+
+    /* d's data now covers b's old header; make it read like a free block */
+    memset(d, 0, 250);
+    struct mem_block *stale = check_header(b);
+    stale->free = true;
+    stale->size = 200;
+
+    CHECK(ok("set warm:1"));
+    char *e = ca_malloc(64);
+    CHECK(e != NULL);
+    uintptr_t base;
+    size_t size;
+    CHECK(allocator_block_of(e, &base, &size) == 0 && base == (uintptr_t) e && size >= 64);
+    CHECK(!overlaps(e, 64, c, 100) && !overlaps(e, 64, d, 250));
+    ca_free(e);
+    ca_free(d);
+    ca_free(c);
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    check_env(argv, "ALLOCATOR_CONTROL", "/tmp/allocator-check.%p.ctl", "ALLOCATOR_WARM", "1");
+
+    /* Nothing has been allocated yet, so main can still pick the engine */
+    setenv("ALLOCATOR_ALGORITHM", "worst_fit", 1);
+    ca_free(ca_malloc(1));
+#ifndef ALLOCATOR_ENGINE
+    CHECK(setting("algorithm worst_fit"));
+
+    CHECK(ok("set algorithm:first_fit"));
+    check_warm_toggle();
+
+    CHECK(ok("set algorithm:best_fit"));
+    CHECK(setting("algorithm best_fit"));
+    CHECK(rejected("set algorithm:bset_fit"));
+    CHECK(setting("algorithm best_fit"));
+#else
+    /* The engine is compiled in, so setting it would change nothing */
+    CHECK(setting("algorithm best_fit"));
+    CHECK(rejected("set algorithm:first_fit"));
+    CHECK(rejected("set warm:1,algorithm:worst_fit"));
+    CHECK(setting("algorithm best_fit") && setting("warm 1"));
+    check_warm_toggle();
+#endif
+
+    /* One bad value rejects the whole command */
+    CHECK(rejected("set sample:7,warm:2"));
+    CHECK(setting("sample 0"));
+    CHECK(rejected("set sample:12x"));
+    CHECK(rejected("set sample:99999999999999999999999"));
+    CHECK(ok("set sample:7,warm:0"));
+    CHECK(setting("sample 7") && setting("warm 0"));
+
+    CHECK(rejected("set emptiness:101"));
+    CHECK(ok("set emptiness:100"));
+    CHECK(rejected("set overflow_budget:64Q"));
+    CHECK(rejected("set overflow_threshold:"));
+    CHECK(ok("set overflow_budget:64M,overflow_threshold:1m"));
+
+    /* Options that fix how regions are mapped can't change at runtime */
+    CHECK(rejected("set hugepages:1"));
+    CHECK(rejected("set routes:64=mmap"));
+    CHECK(rejected("bogus"));
+
+    return check_done(argv[0]);
+}
@@ -0,0 +1,101 @@
+/**
+ * @file
+ *
+ * Coroutine frames at thread exit: a thread_local constructed before the
+ * thread's first frame is destroyed after the pool has parked its state.
+ * Its destructor still frees a frame and allocates a new one, and the state
+ * ends up parked exactly once, with every frame back in it, for the next
+ * thread to adopt.
+ */
+
+#include <coroutine>
+#include <exception>
+#include <thread>
+#include <utility>
+
+#include "check.h"
+#include "../coro_alloc.hpp"
+
+struct task {
+    struct promise_type : ca::frame_allocated {
+        task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    explicit task(std::coroutine_handle<promise_type> h) : handle(h) {}
+    task(task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+    ~task()
+    {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+static task step(int *count)
+{
+    ++*count;
+    co_return;
+}
+
+static int g_steps = 0;
+static void *g_late_frame = nullptr; /*!< Frame of the coroutine the holder frees */
+
+/* Constructed before the thread's first frame, so destroyed after the pool */
+struct holder {
+    task *kept = nullptr;
+
+    ~holder()
+    {
+        delete kept;
+        task late = step(&g_steps);
+        late.handle.resume();
+    }
+};
+
+/* Function-local, so it is constructed on first use rather than along with
+ * the namespace-scope thread_locals */
+static holder &thread_holder()
+{
+    static thread_local holder h;
+    return h;
+}
+
+static void worker()
+{
+    thread_holder().kept = nullptr;
+    task first = step(&g_steps);
+    first.handle.resume();
+    thread_holder().kept = new task(step(&g_steps));
+    g_late_frame = thread_holder().kept->handle.address();
+}
+
+static int parked_states()
+{
+    std::lock_guard<std::mutex> guard(ca::detail::parked_mutex);
+    int count = 0;
+    for (ca::detail::frame_state *s = ca::detail::parked; s != nullptr; s = s->next) {
+        count++;
+    }
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    std::thread thread(worker);
+    thread.join();
+    CHECK(g_steps == 2);
+    CHECK(parked_states() == 1);
+
+    /* The adopting thread gets the frame freed after the state was parked */
+    task again = step(&g_steps);
+    CHECK(again.handle.address() == g_late_frame);
+    CHECK(parked_states() == 0);
+    return check_done(argv[0]);
+}
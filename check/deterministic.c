@@ -0,0 +1,55 @@
+/**
+ * @file
+ *
+ * Deterministic mode: with ALLOCATOR_DETERMINISTIC=1, two runs of the same
+ * allocations lay the heap out at the same addresses, inside the fixed
+ * reservation, so their print_memory output is identical.
+ */
+
+#include "check.h"
+
+static char g_runs[2][16384];
+
+/* Allocations of assorted sizes with holes, then the heap as printed */
+static void workload(void)
+{
+    void *blocks[64];
+    for (int i = 0; i < 64; i++) {
+        blocks[i] = i % 16 == 0 ? ca_malloc_name(20000 + i, "large") : ca_malloc(16 + i * 24);
+    }
+    for (int i = 0; i < 64; i += 3) {
+        ca_free(blocks[i]);
+    }
+    ca_print_memory();
+}
+
+/* Runs the workload in a new process of this program */
+static void run(char *output, size_t size)
+{
+    char path[4096], command[4200];
+    ssize_t path_len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    CHECK(path_len > 0);
+    path[path_len] = '\0';
+    snprintf(command, sizeof(command), "'%s' workload", path);
+    FILE *child = popen(command, "r");
+    CHECK(child != NULL);
+    size_t len = fread(output, 1, size - 1, child);
+    output[len] = '\0';
+    CHECK(pclose(child) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "workload") == 0) {
+        workload();
+        return EXIT_SUCCESS;
+    }
+    check_env(argv, "ALLOCATOR_DETERMINISTIC", "1");
+
+    run(g_runs[0], sizeof(g_runs[0]));
+    run(g_runs[1], sizeof(g_runs[1]));
+    CHECK(strstr(g_runs[0], "[REGION] 0] 0x100000000000") != NULL);
+    CHECK(strstr(g_runs[0], "'large'") != NULL);
+    CHECK(strcmp(g_runs[0], g_runs[1]) == 0);
+    return check_done(argv[0]);
+}
@@ -0,0 +1,65 @@
+/**
+ * @file
+ *
+ * In-place region growth: when nothing fits and the newest region ends in a
+ * free block, the region grows into its headroom instead of a new one being
+ * mapped, so a block can straddle the old end and later coalesce with the
+ * blocks before it. Growth that can't happen in place is counted as an
+ * attempt without success, and a new region is mapped instead.
+ */
+
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "check.h"
+
+static struct allocator_stats stats(void)
+{
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    return stats;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    size_t page_size = getpagesize();
+    char *first = ca_malloc(2000);
+    CHECK(first != NULL && stats().extend_attempts == 0);
+    char *base = (char *) check_header(first);
+
+    /* The rest of the first page is too small: the region grows */
+    char *straddling = ca_malloc(3000);
+    CHECK(stats().extend_attempts == 1 && stats().extend_successes == 1);
+    CHECK(stats().regions == 1 && stats().region_bytes == 2 * page_size);
+    CHECK(check_header(straddling) == (struct mem_block *) (base + check_header(first)->size));
+    CHECK(check_header(straddling)->region_id == check_header(first)->region_id);
+    CHECK(straddling < base + page_size && straddling + 3000 > base + page_size);
+    char *kept = ca_malloc(100);
+    CHECK(check_header(kept)->region_id == check_header(first)->region_id);
+
+    /* Past the headroom the pages are taken, so the region can't grow */
+    void *blocker = mmap(base + page_size + (1 << 20), page_size, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    CHECK(blocker != MAP_FAILED || errno == EEXIST);
+    char *large = ca_malloc(2 << 20);
+    CHECK(large != NULL && check_header(large)->region_id != check_header(first)->region_id);
+    CHECK(stats().extend_attempts == 2 && stats().extend_successes == 1);
+    CHECK(stats().regions == 2);
+
+    /* The straddling block merges with the one before it */
+    size_t merged = check_header(first)->size + check_header(straddling)->size;
+    ca_free(first);
+    ca_free(straddling);
+    CHECK(check_header(first)->free && check_header(first)->size == merged);
+    CHECK(ca_malloc(merged - sizeof(struct mem_block)) == first);
+
+    ca_free(first);
+    ca_free(kept);
+    ca_free(large);
+    CHECK(stats().regions == 0);
+    if (blocker != MAP_FAILED) {
+        munmap(blocker, page_size);
+    }
+    return check_done(argv[0]);
+}
@@ -0,0 +1,62 @@
+/**
+ * @file
+ *
+ * The hugepage filler: with ALLOCATOR_HUGEPAGES=1 a region smaller than a
+ * hugepage is carved out of the fullest hugepage that has room for it, and
+ * a hugepage is released once the last region in it is.
+ */
+
+#include "check.h"
+
+#define HUGEPAGE (2UL << 20)
+
+static uintptr_t hugepage_of(const void *ptr)
+{
+    return (uintptr_t) ptr & ~(HUGEPAGE - 1);
+}
+
+static unsigned long hugepages(void)
+{
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    return stats.hugepages;
+}
+
+/* Size whose block fills `pages` pages exactly, leaving no free tail */
+static size_t filling(size_t pages)
+{
+    return pages * getpagesize() - sizeof(struct mem_block);
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    check_env(argv, "ALLOCATOR_HUGEPAGES", "1");
+    CHECK(getpagesize() == 4096);
+
+    /* 300 and 400 pages can't share a 512 page hugepage */
+    char *emptier = ca_malloc(filling(300));
+    char *fuller = ca_malloc(filling(400));
+    CHECK(emptier != NULL && fuller != NULL);
+    CHECK(hugepage_of(emptier) != hugepage_of(fuller));
+    CHECK(hugepages() == 2);
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    CHECK(stats.hugepage_region_bytes == 700 * 4096);
+
+    /* Both have room for a page; the fuller one gets it */
+    char *small = ca_malloc(filling(1));
+    CHECK(small != NULL && hugepage_of(small) == hugepage_of(fuller));
+    CHECK(hugepages() == 2);
+
+    /* The hugepage stays while any region is left in it */
+    ca_free(fuller);
+    CHECK(hugepages() == 2);
+    ca_free(small);
+    CHECK(hugepages() == 1);
+    ca_free(emptier);
+    CHECK(hugepages() == 0);
+    allocator_stats(&stats);
+    CHECK(stats.hugepage_region_bytes == 0);
+    return check_done(argv[0]);
+}
@@ -0,0 +1,90 @@
+/**
+ * @file
+ *
+ * Thread heaps under the emptiness invariant: a thread heap keeps its
+ * regions while its unused bytes stay within the 256 KB slack, gives a
+ * region up to the global pool once it holds too much unused memory, and
+ * another thread adopts that region before mapping one of its own.
+ */
+
+#include <pthread.h>
+
+#include "check.h"
+
+#define OBJECTS 100
+#define KEPT 5
+
+static char *g_objects[OBJECTS];
+static unsigned long g_regions[OBJECTS]; /* region_id of each object */
+static char *g_adopted;
+
+static struct allocator_stats stats(void)
+{
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    return stats;
+}
+
+/* Allocates about 1 MB and frees all but the last few objects */
+static void *producer(void *arg)
+{
+    (void) arg;
+    for (int i = 0; i < OBJECTS; i++) {
+        g_objects[i] = ca_malloc(10000);
+        CHECK(g_objects[i] != NULL);
+        g_regions[i] = check_header(g_objects[i])->region_id;
+    }
+
+    /* 200 KB unused is within the slack */
+    for (int i = 0; i < 20; i++) {
+        ca_free(g_objects[i]);
+    }
+    CHECK(stats().heap_releases == 0);
+
+    for (int i = 20; i < OBJECTS - KEPT; i++) {
+        ca_free(g_objects[i]);
+    }
+    CHECK(stats().heap_releases >= 1);
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    (void) arg;
+    g_adopted = ca_malloc(10000);
+    return NULL;
+}
+
+static void run(void *(*fn)(void *))
+{
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, fn, NULL) == 0);
+    pthread_join(thread, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    check_env(argv, "ALLOCATOR_HEAPS", "1");
+
+    run(producer);
+    unsigned long regions = stats().regions;
+    CHECK(stats().heap_adoptions == 0);
+
+    /* The new thread's heap is empty, so it takes over a released region */
+    run(consumer);
+    CHECK(g_adopted != NULL && stats().heap_adoptions == 1);
+    CHECK(stats().regions == regions);
+    bool found = false;
+    for (int i = 0; i < OBJECTS; i++) {
+        found |= g_regions[i] == check_header(g_adopted)->region_id;
+    }
+    CHECK(found);
+
+    ca_free(g_adopted);
+    for (int i = OBJECTS - KEPT; i < OBJECTS; i++) {
+        ca_free(g_objects[i]);
+    }
+    CHECK(stats().regions == 0);
+    return check_done(argv[0]);
+}
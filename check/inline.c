@@ -0,0 +1,37 @@
+/**
+ * @file
+ *
+ * The inlinable fast path: sizes too large for a block get NULL instead of
+ * a wrapped-around small block, as through ca_malloc, and sampled
+ * allocations record the function that made them as their site.
+ */
+
+#include <errno.h>
+
+#include "check.h"
+#include "../allocator_inline.h"
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    check_env(argv, "ALLOCATOR_SAMPLE", "1");
+
+    CHECK(ca_block_size(SIZE_MAX - 10) == 0 && ca_block_size(PTRDIFF_MAX) == 0);
+    errno = 0;
+    CHECK(ca_malloc_inline(SIZE_MAX - 10) == NULL && errno == ENOMEM);
+    CHECK(ca_malloc(SIZE_MAX - 10) == NULL);
+    CHECK(ca_alloc_block(64, 0) == NULL);
+
+    char *inlined = ca_malloc_inline(64);
+    char *called = ca_malloc(64);
+    CHECK(inlined != NULL && called != NULL && ca_usable_size(inlined) >= 64);
+    for (char *ptr = inlined; ptr != NULL; ptr = ptr == inlined ? called : NULL) {
+        struct mem_block *block = check_header(ptr);
+        CHECK(block->flags & BLOCK_SAMPLED);
+        CHECK(block->site > (uintptr_t) main && block->site < (uintptr_t) main + 4096);
+    }
+    ca_free_inline(inlined);
+    ca_free_inline(called);
+    ca_free_inline(NULL);
+    return check_done(argv[0]);
+}
@@ -0,0 +1,92 @@
+/**
+ * @file
+ *
+ * allocator_iterate: every live allocation overlapping the range is
+ * reported once, whole, with its usable size. Freed blocks, allocations
+ * outside the range and regions that no longer hold anything are left out.
+ */
+
+#include "check.h"
+
+#define BLOCKS 10
+
+static uintptr_t g_seen[64];
+static size_t g_sizes[64];
+static int g_count;
+
+static void record(uintptr_t base, size_t size, void *arg)
+{
+    CHECK(arg == &g_count && g_count < 64);
+    g_seen[g_count] = base;
+    g_sizes[g_count] = size;
+    g_count++;
+}
+
+static int walk(const void *base, size_t size)
+{
+    g_count = 0;
+    allocator_disable();
+    allocator_iterate((uintptr_t) base, size, record, &g_count);
+    allocator_enable();
+    return g_count;
+}
+
+static bool seen(const void *ptr)
+{
+    for (int i = 0; i < g_count; i++) {
+        if (g_seen[i] == (uintptr_t) ptr) {
+            return g_sizes[i] == check_header(ptr)->size - sizeof(struct mem_block);
+        }
+    }
+    return false;
+}
+
+static void *tagged(const char *tag, size_t size)
+{
+    alloc_tag_set(tag);
+    void *ptr = ca_malloc(size);
+    alloc_tag_set(NULL);
+    return ptr;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    char *blocks[BLOCKS];
+    for (int i = 0; i < BLOCKS; i++) {
+        blocks[i] = ca_malloc(200);
+    }
+    char *other = tagged("other", 300);
+    char *gone = tagged("gone", 300);
+    CHECK(check_header(other)->region_id != check_header(blocks[0])->region_id);
+    ca_free(blocks[4]);
+    ca_free(gone);
+
+    /* From inside block 3 up to where block 7's data starts */
+    CHECK(walk(blocks[3] + 10, blocks[7] - (blocks[3] + 10)) == 3);
+    CHECK(seen(blocks[3]) && seen(blocks[5]) && seen(blocks[6]));
+
+    /* A single byte inside an allocation */
+    CHECK(walk(other + 299, 1) == 1 && seen(other));
+
+    /* Everything: the blocks but the freed one, and the tagged allocation */
+    CHECK(walk(NULL, UINTPTR_MAX) == BLOCKS - 1 + 1);
+    for (int i = 0; i < BLOCKS; i++) {
+        CHECK(i == 4 || seen(blocks[i]));
+    }
+    CHECK(seen(other));
+
+    /* Only the header of the block after the last one */
+    size_t usable = check_header(blocks[9])->size - sizeof(struct mem_block);
+    CHECK(walk(blocks[9] + usable, sizeof(struct mem_block)) == 0);
+
+    for (int i = 0; i < BLOCKS; i++) {
+        if (i != 4) {
+            ca_free(blocks[i]);
+        }
+    }
+    CHECK(walk(NULL, UINTPTR_MAX) == 1 && seen(other));
+    ca_free(other);
+    CHECK(walk(NULL, UINTPTR_MAX) == 0);
+    return check_done(argv[0]);
+}
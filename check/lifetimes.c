@@ -0,0 +1,82 @@
+/**
+ * @file
+ *
+ * Lifetime histograms: a freed allocation is counted in the size class of
+ * its usable size (powers of 4 from 64 bytes) and the log2 bucket of the
+ * number of allocations made while it lived, itself included.
+ */
+
+#include "check.h"
+
+static struct allocator_lifetimes g_before;
+
+/* Frees ptr and returns the one histogram cell that changed */
+static void free_into(void *ptr, unsigned int *class, unsigned int *bucket)
+{
+    allocator_lifetimes(&g_before);
+    ca_free(ptr);
+    struct allocator_lifetimes after;
+    allocator_lifetimes(&after);
+    int changed = 0;
+    for (unsigned int c = 0; c < CA_LIFETIME_CLASSES; c++) {
+        for (unsigned int b = 0; b < CA_LIFETIME_BUCKETS; b++) {
+            if (after.freed[c][b] != g_before.freed[c][b]) {
+                CHECK(after.freed[c][b] == g_before.freed[c][b] + 1);
+                *class = c;
+                *bucket = b;
+                changed++;
+            }
+        }
+    }
+    CHECK(changed == 1);
+}
+
+/* Class of a size allocated and freed right away, which lives 1 allocation */
+static unsigned int class_of(size_t size)
+{
+    void *ptr = ca_malloc(size);
+    unsigned int class, bucket;
+    free_into(ptr, &class, &bucket);
+    CHECK(bucket == 1);
+    return class;
+}
+
+/* Bucket of an allocation freed after `others` more allocations */
+static unsigned int bucket_after(unsigned int others)
+{
+    void *ptr = ca_malloc(16);
+    for (unsigned int i = 0; i < others; i++) {
+        ca_free(ca_malloc(16));
+    }
+    unsigned int class, bucket;
+    free_into(ptr, &class, &bucket);
+    CHECK(class == 0);
+    return bucket;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+
+    /* Usable sizes are 4 past a multiple of 8: 60, 68, 252, 260, ... */
+    CHECK(class_of(60) == 0);
+    CHECK(class_of(64) == 1);
+    CHECK(class_of(250) == 1);
+    CHECK(class_of(257) == 2);
+    CHECK(class_of(1000) == 2);
+    CHECK(class_of(10000) == 4);
+    CHECK(class_of(60000) == 5);
+    CHECK(class_of(262000) == 6);
+    CHECK(class_of(300000) == 7);
+    CHECK(class_of(64 << 20) == 7);
+
+    /* Bucket b holds lifetimes in [2^(b-1), 2^b) */
+    CHECK(bucket_after(0) == 1);
+    CHECK(bucket_after(1) == 2);
+    CHECK(bucket_after(2) == 2);
+    CHECK(bucket_after(3) == 3);
+    CHECK(bucket_after(6) == 3);
+    CHECK(bucket_after(7) == 4);
+    CHECK(bucket_after(1000) == 10);
+    return check_done(argv[0]);
+}
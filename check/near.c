@@ -0,0 +1,72 @@
+/**
+ * @file
+ *
+ * malloc_near: an allocation goes into the free block nearest its hint
+ * rather than the one the engine would pick, while hints that aren't the
+ * start of a live allocation, and sizes routed to mmap, are placed as if
+ * there were no hint.
+ */
+
+#include "check.h"
+
+#define BLOCKS 16 /* all in the first region */
+
+static unsigned long near_hits(void)
+{
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    return stats.near_hits;
+}
+
+static unsigned long near_requests(void)
+{
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    return stats.near_requests;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    check_env(argv, "ALLOCATOR_ROUTES", "512=first_fit/*=mmap");
+
+    char *blocks[BLOCKS];
+    for (int i = 0; i < BLOCKS; i++) {
+        blocks[i] = ca_malloc(100);
+        CHECK(blocks[i] != NULL);
+        CHECK(check_header(blocks[i])->region_id == check_header(blocks[0])->region_id);
+    }
+
+    /* first_fit would take the hole at 2; the hint asks for the one at 12 */
+    ca_free(blocks[2]);
+    ca_free(blocks[12]);
+    unsigned long hits = near_hits();
+    CHECK(malloc_near(blocks[10], 100) == blocks[12]);
+    CHECK(near_hits() == hits + 1);
+
+    /* Pointers inside a block, to freed memory or elsewhere are no hints */
+    unsigned long requests = near_requests();
+    ca_free(blocks[13]);
+    CHECK(malloc_near(blocks[11] + 1, 100) == blocks[2]);
+    CHECK(malloc_near(blocks[13], 100) == blocks[13]);
+    int local = 0;
+    ca_free(blocks[3]);
+    CHECK(malloc_near(&local, 100) == blocks[3]);
+    CHECK(near_requests() == requests);
+
+    /* An 800-byte hole right after the hint, but the size is routed to mmap */
+    for (int i = 5; i < 9; i++) {
+        ca_free(blocks[i]);
+    }
+    char *direct = malloc_near(blocks[4], 600);
+    CHECK(direct != NULL && check_header(direct)->region_id != check_header(blocks[4])->region_id);
+    CHECK(near_requests() == requests);
+    ca_free(direct);
+
+    for (int i = 0; i < BLOCKS; i++) {
+        if (i < 5 || i > 8) {
+            ca_free(blocks[i]);
+        }
+    }
+    return check_done(argv[0]);
+}
@@ -0,0 +1,58 @@
+/**
+ * @file
+ *
+ * The file-backed overflow tier: a new region goes to a file only when it is
+ * at least overflow_threshold bytes and would take the anonymous regions
+ * past overflow_budget, and file regions are counted separately until they
+ * are released.
+ */
+
+#include "check.h"
+
+#define MB (1UL << 20)
+
+static struct allocator_stats stats(void)
+{
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    return stats;
+}
+
+/* Size whose block fills a region of `bytes` exactly, so it never grows */
+static size_t filling(size_t bytes)
+{
+    return bytes - sizeof(struct mem_block);
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    check_env(argv, "ALLOCATOR_OVERFLOW_BUDGET", "4M", "ALLOCATOR_OVERFLOW_THRESHOLD", "1M",
+            "ALLOCATOR_OVERFLOW_DIR", "/tmp");
+
+    char *first = ca_malloc(filling(3 * MB));
+    CHECK(first != NULL && stats().file_regions == 0);
+
+    /* 3 MB + 2 MB is over budget */
+    char *over = ca_malloc(filling(2 * MB));
+    CHECK(over != NULL);
+    memset(over, 1, 2 * MB - sizeof(struct mem_block));
+    CHECK(stats().file_regions == 1 && stats().file_bytes == 2 * MB);
+    CHECK(stats().regions == 2 && stats().region_bytes == 5 * MB);
+
+    /* Over budget too, but below the threshold */
+    char *small = ca_malloc(filling(MB / 2));
+    CHECK(small != NULL && stats().file_regions == 1);
+
+    /* Only anonymous regions count against the budget: 0.5 MB + 2 MB fits */
+    ca_free(first);
+    char *under = ca_malloc(filling(2 * MB));
+    CHECK(under != NULL && stats().file_regions == 1 && stats().file_bytes == 2 * MB);
+
+    ca_free(over);
+    CHECK(stats().file_regions == 0 && stats().file_bytes == 0);
+    ca_free(small);
+    ca_free(under);
+    CHECK(stats().regions == 0);
+    return check_done(argv[0]);
+}
@@ -0,0 +1,74 @@
+/**
+ * @file
+ *
+ * rc_alloc, rc_retain and rc_release: the count starts at one, lives in the
+ * header right before the data, and the allocation is freed exactly when the
+ * last reference goes, also when threads race to drop theirs.
+ */
+
+#include <pthread.h>
+
+#include "check.h"
+
+#define THREADS 4
+#define ROUNDS 20000
+
+static void *g_shared[ROUNDS];
+
+/* Takes and drops references to every shared object, dropping one extra */
+static void *race(void *arg)
+{
+    (void) arg;
+    for (int i = 0; i < ROUNDS; i++) {
+        rc_retain(g_shared[i]);
+        rc_release(g_shared[i]);
+        rc_release(g_shared[i]);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    char *obj = rc_alloc(64);
+    CHECK(obj != NULL);
+    struct mem_block *header = check_header(obj);
+    CHECK(header->refs == 1);
+    memset(obj, 0xff, 64);
+    CHECK(header->refs == 1);
+
+    CHECK(rc_retain(obj) == obj);
+    CHECK(rc_retain(obj) == obj);
+    CHECK(rc_release(obj) == 2);
+    CHECK(rc_release(obj) == 1);
+    CHECK(check_live(obj));
+    CHECK(rc_release(obj) == 0);
+    CHECK(!check_live(obj));
+    CHECK(rc_release(NULL) == 0);
+
+    /* Plain allocations reusing the block don't inherit a count */
+    char *plain = ca_malloc(64);
+    CHECK(plain == obj);
+    ca_free(plain);
+
+    /* Every thread drops one reference: the objects go when the last does */
+    for (int i = 0; i < ROUNDS; i++) {
+        g_shared[i] = rc_alloc(32 + i % 200);
+        CHECK(g_shared[i] != NULL);
+        for (int t = 1; t < THREADS; t++) {
+            rc_retain(g_shared[i]);
+        }
+    }
+    pthread_t threads[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        CHECK(pthread_create(&threads[t], NULL, race, NULL) == 0);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    CHECK(stats.regions == 0);
+
+    return check_done(argv[0]);
+}
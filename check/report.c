@@ -0,0 +1,59 @@
+/**
+ * @file
+ *
+ * Heap reports on a signal: with ALLOCATOR_REPORT_SIGNAL set, the signal
+ * only marks a report as pending, and the next allocator call appends it to
+ * ALLOCATOR_REPORT_PATH outside the signal handler.
+ */
+
+#include <signal.h>
+
+#include "check.h"
+
+static char g_report[8192];
+
+static size_t report_read(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+    size_t len = fread(g_report, 1, sizeof(g_report) - 1, file);
+    g_report[len] = '\0';
+    fclose(file);
+    return len;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    check_env(argv, "ALLOCATOR_REPORT_SIGNAL", "SIGUSR2");
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/allocator-report-check-%d", getpid());
+    setenv("ALLOCATOR_REPORT_PATH", path, 1);
+
+    /* The first allocation reads the configuration and installs the handler */
+    alloc_tag_set("reported");
+    char *kept = ca_malloc(5000);
+    alloc_tag_set(NULL);
+    CHECK(kept != NULL);
+
+    CHECK(raise(SIGUSR2) == 0);
+    CHECK(report_read(path) == 0);
+    ca_free(ca_malloc(10));
+    CHECK(report_read(path) > 0);
+    CHECK(strncmp(g_report, "-- Heap Report (pid ", 20) == 0);
+    CHECK(strstr(g_report, "Top tags:") != NULL && strstr(g_report, "'reported'") != NULL);
+
+    /* One report per signal, appended */
+    size_t len = strlen(g_report);
+    ca_free(ca_malloc(10));
+    CHECK(report_read(path) == len);
+    CHECK(raise(SIGUSR2) == 0);
+    ca_free(kept);
+    CHECK(report_read(path) > len);
+    CHECK(strstr(g_report + len, "-- Heap Report") == g_report + len);
+
+    unlink(path);
+    return check_done(argv[0]);
+}
@@ -0,0 +1,74 @@
+/**
+ * @file
+ *
+ * Engines by size range: each range is served by its own engine, an mmap
+ * range always gets a fresh region even when a free block would fit, and
+ * the per-range counters add up. Also built with the engine fixed at
+ * compile time (routes_best_fit), where only the mmap ranges and the
+ * counters still apply.
+ */
+
+#include "check.h"
+
+static unsigned long region_of(const void *ptr)
+{
+    return check_header(ptr)->region_id;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    check_env(argv, "ALLOCATOR_ROUTES", "256=first_fit/2K=best_fit/*=mmap");
+
+    /* A free block of 4 KB in the first region */
+    char *guard = ca_malloc(40);
+    struct allocator_route_stats routes[4];
+    CHECK(allocator_route_stats(routes, 4) == 3);
+    CHECK(strcmp(routes[0].engine, "first_fit") == 0 && strcmp(routes[1].engine, "best_fit") == 0);
+    CHECK(strcmp(routes[2].engine, "mmap") == 0 && routes[2].limit == SIZE_MAX);
+
+    char *big1 = ca_malloc(2000);
+    char *big2 = ca_malloc(2000);
+    CHECK(region_of(big1) == region_of(guard) && region_of(big2) == region_of(guard));
+    ca_free(big1);
+    ca_free(big2);
+
+    /* It would fit, but the mmap range maps a region of its own */
+    char *direct = ca_malloc(3000);
+    CHECK(direct != NULL && region_of(direct) != region_of(guard));
+    ca_free(direct);
+
+    /* Holes of 1000 and 400 bytes, in that order */
+    char *a = ca_malloc(1000);
+    char *sep1 = ca_malloc(40);
+    char *b = ca_malloc(400);
+    char *sep2 = ca_malloc(40);
+    ca_free(a);
+    ca_free(b);
+#ifndef ALLOCATOR_ENGINE
+    /* first_fit takes the first hole, best_fit the smallest that fits */
+    char *small = ca_malloc(200);
+    CHECK(small == a);
+    char *medium = ca_malloc(350);
+    CHECK(medium == b);
+#else
+    char *small = ca_malloc(200);
+    char *medium = ca_malloc(350);
+    CHECK(region_of(small) == region_of(guard) && region_of(medium) == region_of(guard));
+#endif
+
+    CHECK(allocator_route_stats(routes, 4) == 3);
+    CHECK(routes[0].allocations == 4 && routes[0].frees == 0);
+    CHECK(routes[1].allocations == 5 && routes[1].frees == 4);
+    CHECK(routes[2].allocations == 1 && routes[2].frees == 1 && routes[2].live_bytes == 0);
+
+    ca_free(small);
+    ca_free(medium);
+    ca_free(sep1);
+    ca_free(sep2);
+    ca_free(guard);
+    CHECK(allocator_route_stats(routes, 4) == 3);
+    CHECK(routes[0].live_bytes == 0 && routes[1].live_bytes == 0);
+
+    return check_done(argv[0]);
+}
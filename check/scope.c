@@ -0,0 +1,66 @@
+/**
+ * @file
+ *
+ * Allocation accounting: each thread's counters grow by the usable size of
+ * what it allocates and frees, whichever thread allocated the memory, and
+ * alloc_scope reports the difference over a scope.
+ */
+
+#include <pthread.h>
+
+#include "check.h"
+
+static uint64_t usable(const void *ptr)
+{
+    return check_header(ptr)->size - sizeof(struct mem_block);
+}
+
+static void *g_handed_over;
+
+/* Frees main's allocation and makes one of its own */
+static void *worker(void *arg)
+{
+    (void) arg;
+    CHECK(*allocator_thread_allocatedp() == 0 && *allocator_thread_deallocatedp() == 0);
+    uint64_t size = usable(g_handed_over);
+    ca_free(g_handed_over);
+    CHECK(*allocator_thread_deallocatedp() == size);
+    ca_free(ca_malloc(1000));
+    CHECK(*allocator_thread_allocatedp() > 1000);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    uint64_t *allocated = allocator_thread_allocatedp();
+    uint64_t *deallocated = allocator_thread_deallocatedp();
+
+    uint64_t before = *allocated;
+    char *first = ca_malloc(100);
+    uint64_t first_size = usable(first);
+    CHECK(*allocated == before + first_size);
+
+    struct alloc_scope scope;
+    alloc_scope_begin(&scope);
+    char *second = ca_malloc(300);
+    char *third = ca_malloc(5000);
+    ca_free(first);
+    uint64_t expected = usable(second) + usable(third);
+    CHECK(alloc_scope_end(&scope) == expected);
+    CHECK(scope.allocated == expected && scope.deallocated == first_size);
+
+    /* The worker's allocations and frees land on its own counters */
+    before = *allocated;
+    uint64_t freed = *deallocated;
+    uint64_t third_size = usable(third);
+    g_handed_over = second;
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, worker, NULL) == 0);
+    pthread_join(thread, NULL);
+    CHECK(*allocated == before && *deallocated == freed);
+
+    ca_free(third);
+    CHECK(*deallocated == freed + third_size);
+    return check_done(argv[0]);
+}
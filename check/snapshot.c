@@ -0,0 +1,76 @@
+/**
+ * @file
+ *
+ * Heap snapshots: heap_snapshot_diff lists the tags that grew between two
+ * snapshots, largest growth first, and leaves out those that shrank or
+ * stayed the same.
+ */
+
+#include "check.h"
+
+static char g_output[4096];
+
+/* Runs heap_snapshot_diff with stdout going to g_output */
+static unsigned int diff(const struct heap_snapshot *a, const struct heap_snapshot *b)
+{
+    FILE *out = tmpfile();
+    CHECK(out != NULL);
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    dup2(fileno(out), STDOUT_FILENO);
+    unsigned int grew = heap_snapshot_diff(a, b);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    rewind(out);
+    size_t len = fread(g_output, 1, sizeof(g_output) - 1, out);
+    g_output[len] = '\0';
+    fclose(out);
+    return grew;
+}
+
+static void *tagged(const char *tag, size_t size)
+{
+    alloc_tag_set(tag);
+    void *ptr = ca_malloc(size);
+    alloc_tag_set(NULL);
+    CHECK(ptr != NULL);
+    return ptr;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    void *shrinking = tagged("shrinking", 8000);
+    void *kept = tagged("shrinking", 100);
+    void *steady = tagged("steady", 3000);
+    struct heap_snapshot *before = heap_snapshot_take();
+    CHECK(before != NULL);
+
+    void *grown[] = { tagged("small", 1000), tagged("large", 20000), tagged("medium", 6000) };
+    ca_free(shrinking);
+    struct heap_snapshot *after = heap_snapshot_take();
+    CHECK(after != NULL);
+
+    CHECK(diff(before, after) == 3);
+    char *large = strstr(g_output, "'large'");
+    char *medium = strstr(g_output, "'medium'");
+    char *small = strstr(g_output, "'small'");
+    CHECK(large != NULL && medium != NULL && small != NULL);
+    CHECK(large < medium && medium < small);
+    CHECK(strstr(g_output, "'shrinking'") == NULL && strstr(g_output, "'steady'") == NULL);
+
+    /* Nothing grew going the other way but the tag that shrank */
+    CHECK(diff(after, before) == 1);
+    CHECK(strstr(g_output, "'shrinking'") != NULL && strstr(g_output, "'large'") == NULL);
+
+    heap_snapshot_free(before);
+    heap_snapshot_free(after);
+    for (int i = 0; i < 3; i++) {
+        ca_free(grown[i]);
+    }
+    ca_free(kept);
+    ca_free(steady);
+    return check_done(argv[0]);
+}
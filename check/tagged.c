@@ -0,0 +1,99 @@
+/**
+ * @file
+ *
+ * Tag scopes and free_all_tagged: tags nest, tagged blocks never share a
+ * region with other tags, and freeing a tag releases its allocations from
+ * every thread while leaving everything else, and the list around it,
+ * intact.
+ */
+
+#include <pthread.h>
+
+#include "check.h"
+
+#define OBJECTS 300
+
+static char *g_parser[OBJECTS];
+static char *g_plain[OBJECTS];
+
+static size_t size_of(int i)
+{
+    return i % 50 == 0 ? 20000 : 16 + i % 300;
+}
+
+/* Tags its allocations on another thread */
+static void *parse(void *arg)
+{
+    char **out = arg;
+    alloc_tag_set("parser");
+    for (int i = 0; i < OBJECTS; i++) {
+        out[i] = ca_malloc(size_of(i));
+    }
+    alloc_tag_set(NULL);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    /* Interleave tagged and untagged allocations */
+    for (int i = 0; i < OBJECTS; i++) {
+        CHECK(alloc_tag_set("parser") == NULL);
+        g_parser[i] = ca_malloc(size_of(i));
+        CHECK(strcmp(alloc_tag_set(NULL), "parser") == 0);
+        g_plain[i] = ca_malloc(size_of(i));
+        CHECK(g_parser[i] != NULL && g_plain[i] != NULL);
+        memset(g_plain[i], i & 0xff, size_of(i));
+    }
+
+    CHECK(alloc_tag_set("parser") == NULL);
+    CHECK(strcmp(alloc_tag_set("lexer"), "parser") == 0);
+    char *token = ca_malloc(40);
+    CHECK(strcmp(alloc_tag_set("parser"), "lexer") == 0);
+    alloc_tag_set(NULL);
+    memset(token, 0x11, 40);
+
+    for (int i = 0; i < OBJECTS; i++) {
+        struct mem_block *tagged = check_header(g_parser[i]);
+        struct mem_block *plain = check_header(g_plain[i]);
+        CHECK(tagged->tag != 0 && plain->tag == 0);
+        CHECK(tagged->region_id != plain->region_id);
+        CHECK(tagged->region_id != check_header(token)->region_id);
+    }
+
+    char *threaded[OBJECTS];
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, parse, threaded) == 0);
+    pthread_join(thread, NULL);
+
+    CHECK(free_all_tagged("parser") > 0);
+    for (int i = 0; i < OBJECTS; i++) {
+        CHECK(!check_live(g_parser[i]) && !check_live(threaded[i]));
+        CHECK(check_live(g_plain[i]));
+        for (size_t j = 0; j < size_of(i); j++) {
+            CHECK((unsigned char) g_plain[i][j] == (i & 0xff));
+        }
+    }
+    CHECK(check_live(token) && token[39] == 0x11);
+    CHECK(free_all_tagged("parser") == 0);
+    CHECK(free_all_tagged("unknown") == 0);
+    CHECK(free_all_tagged(NULL) == 0);
+
+    /* The list still links up: the untagged blocks can be freed and reused */
+    for (int i = 0; i < OBJECTS; i += 2) {
+        ca_free(g_plain[i]);
+    }
+    for (int i = 0; i < OBJECTS; i += 2) {
+        g_plain[i] = ca_malloc(size_of(i));
+        CHECK(g_plain[i] != NULL && check_header(g_plain[i])->tag == 0);
+    }
+    for (int i = 0; i < OBJECTS; i++) {
+        ca_free(g_plain[i]);
+    }
+    CHECK(free_all_tagged("lexer") > 0);
+    struct allocator_stats stats;
+    allocator_stats(&stats);
+    CHECK(stats.regions == 0);
+
+    return check_done(argv[0]);
+}
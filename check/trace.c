@@ -0,0 +1,65 @@
+/**
+ * @file
+ *
+ * Allocation tracing: with ALLOCATOR_TRACE set, every allocation and free is
+ * written to the trace in order, in the format allocsim replays, and the
+ * trace is complete once the process exits.
+ */
+
+#include <sys/wait.h>
+
+#include "check.h"
+
+struct op {
+    char kind;
+    unsigned int thread;
+    unsigned long ns;
+    unsigned long id;
+    size_t size;
+};
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/allocator-trace-check-%d", getpid());
+    setenv("ALLOCATOR_TRACE", path, 1);
+
+    /* The trace is flushed at exit, so the allocations are made in a child */
+    pid_t pid = fork();
+    CHECK(pid != -1);
+    if (pid == 0) {
+        char *small = ca_malloc(100);
+        char *large = ca_malloc(5000);
+        ca_free(small);
+        ca_free(large);
+        exit(EXIT_SUCCESS);
+    }
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    FILE *trace = fopen(path, "r");
+    CHECK(trace != NULL);
+    struct op ops[5];
+    int count = 0;
+    char line[128];
+    while (count < 5 && fgets(line, sizeof(line), trace) != NULL) {
+        struct op *op = &ops[count++];
+        op->size = 0;
+        int fields = sscanf(line, "%c %u %lu %lx %zu", &op->kind, &op->thread, &op->ns, &op->id,
+                &op->size);
+        CHECK(fields == (op->kind == 'a' ? 5 : 4));
+    }
+    fclose(trace);
+    unlink(path);
+
+    CHECK(count == 4);
+    CHECK(ops[0].kind == 'a' && ops[0].size == 100);
+    CHECK(ops[1].kind == 'a' && ops[1].size == 5000);
+    CHECK(ops[2].kind == 'f' && ops[2].id == ops[0].id);
+    CHECK(ops[3].kind == 'f' && ops[3].id == ops[1].id);
+    for (int i = 1; i < count; i++) {
+        CHECK(ops[i].thread == ops[0].thread && ops[i].ns >= ops[i - 1].ns);
+    }
+    return check_done(argv[0]);
+}
@@ -0,0 +1,72 @@
+/**
+ * @file
+ *
+ * Warm placement: with ALLOCATOR_WARM=1 an allocation goes next to the
+ * block the thread freed last, ahead of an earlier hole the engine would
+ * pick, and only while that region has been used recently.
+ */
+
+#include <pthread.h>
+
+#include "check.h"
+
+#define BLOCKS 64
+
+/* Allocates and frees in regions of its own, moving the clock along */
+static void *churn(void *arg)
+{
+    (void) arg;
+    for (int i = 0; i < 2100; i++) {
+        ca_free(ca_malloc(1 << 20));
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    check_env(argv, "ALLOCATOR_WARM", "1");
+
+    char *blocks[BLOCKS];
+    for (int i = 0; i < BLOCKS; i++) {
+        blocks[i] = ca_malloc(100);
+        CHECK(blocks[i] != NULL);
+    }
+
+    /* first_fit alone would take the hole at 10 */
+    ca_free(blocks[10]);
+    ca_free(blocks[50]);
+    struct allocator_stats before;
+    allocator_stats(&before);
+    char *placed = ca_malloc(100);
+    CHECK(placed == blocks[50]);
+    struct allocator_stats after;
+    allocator_stats(&after);
+    CHECK(after.warm_hits == before.warm_hits + 1);
+    blocks[50] = placed;
+
+    /* Once the warm block is taken, the nearest hole around it is next */
+    ca_free(blocks[45]);
+    ca_free(blocks[47]);
+    CHECK(ca_malloc(100) == blocks[47]);
+    CHECK(ca_malloc(100) == blocks[45]);
+
+    /* After 4096 allocations and frees elsewhere the region is cold, and
+     * the engine decides again */
+    ca_free(blocks[30]);
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, churn, NULL) == 0);
+    pthread_join(thread, NULL);
+    allocator_stats(&before);
+    placed = ca_malloc(100);
+    allocator_stats(&after);
+    CHECK(placed == blocks[10]);
+    CHECK(after.warm_hits == before.warm_hits);
+    blocks[10] = placed;
+    blocks[30] = NULL;
+
+    for (int i = 0; i < BLOCKS; i++) {
+        ca_free(blocks[i]);
+    }
+    return check_done(argv[0]);
+}
@@ -0,0 +1,318 @@
+/**
+ * @file
+ *
+ * Coroutine frame allocation for C++20 code running on this allocator.
+ *
+ * A coroutine's frame is heap allocated every time it is called, and is
+ * freed when it finishes. With the global operator new each frame becomes a
+ * block in the allocator's list, with a 100 byte header and a trip through
+ * the lock. Frames are short lived and come in a handful of sizes (one per
+ * coroutine function), so they are served here from per-thread free lists
+ * instead, one list per power-of-two size class from 64 bytes to 4 KB. The
+ * lists are filled by carving chunks obtained with ca_malloc, so the list
+ * only sees one block per chunk.
+ *
+ * Frame memory is kept for reuse rather than returned to the allocator. When
+ * a thread exits its lists and chunks are parked and adopted by the next
+ * thread that allocates a frame, so churning threads do not grow the pool.
+ * thread_local destructors that run after the state was parked may still
+ * allocate and free frames. Each frame carries a small header naming the
+ * thread state it was carved for. A frame freed on another thread goes back
+ * to that state through a lock-free remote list, which the owner drains when
+ * its own list runs dry, so a producer/consumer pair keeps reusing the
+ * producer's frames instead of piling them up on the consumer.
+ *
+ * To use it, derive the promise type from ca::frame_allocated:
+ *
+ *     struct promise_type : ca::frame_allocated { ... };
+ */
+
+#ifndef CORO_ALLOC_HPP
+#define CORO_ALLOC_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+#include "allocator.h"
+
+namespace ca {
+
+namespace detail {
+
+constexpr std::size_t frame_min = 64;          /*!< Smallest frame size class */
+constexpr std::size_t frame_classes = 7;       /*!< 64 B .. 4 KB */
+constexpr std::size_t frame_chunk = 64 * 1024; /*!< Bytes requested from ca_malloc per chunk */
+constexpr std::size_t frame_align = alignof(std::max_align_t);
+
+/**
+ * frame_class maps a frame size to its size class
+ * @param size frame size passed to operator new
+ *
+ * @return class index, or frame_classes if the frame is too large to pool
+ */
+inline std::size_t frame_class(std::size_t size)
+{
+    std::size_t cls = 0;
+    std::size_t cap = frame_min;
+    while (cap < size && cls < frame_classes) {
+        cap <<= 1;
+        cls++;
+    }
+    return cls;
+}
+
+struct frame_state;
+
+/* Precedes every pooled frame; the size keeps frames aligned */
+struct alignas(frame_align) frame_header {
+    frame_state *owner;
+    std::size_t cls;
+};
+
+struct free_frame {
+    free_frame *next;
+};
+
+inline frame_header *header_of(void *frame)
+{
+    return static_cast<frame_header *>(frame) - 1;
+}
+
+/**
+ * @struct frame_state free lists and the chunk being carved, owned by one
+ * thread. Chunks are never freed, so they are not tracked once carved.
+ * @var lists free frames per size class
+ * @var remote frames of any class freed by other threads, not yet sorted
+ * into lists
+ * @var bump next uncarved byte of the newest chunk
+ * @var bump_left bytes left to carve in the newest chunk
+ * @var next link in the parked list once the owning thread has exited
+ */
+struct frame_state {
+    free_frame *lists[frame_classes] = {};
+    std::atomic<free_frame *> remote{nullptr};
+    char *bump = nullptr;
+    std::size_t bump_left = 0;
+    frame_state *next = nullptr;
+};
+
+/* States left behind by exited threads, waiting to be adopted */
+inline std::mutex parked_mutex;
+inline frame_state *parked = nullptr;
+
+/*
+ * This thread's state. A plain pointer, so it is never destroyed and stays
+ * usable while other thread_local destructors run at thread exit.
+ */
+inline thread_local frame_state *tls_state = nullptr;
+inline thread_local bool tls_exited = false; /*!< frame_exit has parked the state */
+
+/* Hands a state over to the next thread that needs one */
+inline void park(frame_state *s)
+{
+    std::lock_guard<std::mutex> guard(parked_mutex);
+    s->next = parked;
+    parked = s;
+}
+
+/**
+ * frame_exit parks the thread's state when the thread exits. Frames may
+ * still be freed or allocated afterwards by thread_local destructors that
+ * run later; see frame_pool.
+ */
+struct frame_exit {
+    ~frame_exit()
+    {
+        tls_exited = true;
+        if (tls_state != nullptr) {
+            park(tls_state);
+            tls_state = nullptr;
+        }
+    }
+};
+
+inline thread_local frame_exit tls_exit;
+
+/**
+ * frame_pool works on the calling thread's frame_state. The state is taken
+ * on first use, from the parked list when possible, and parked again by
+ * frame_exit when the thread exits. After that the thread owns no state: a
+ * frame it frees goes to its owner's remote list like any other thread's,
+ * and a frame it allocates comes from a state that is parked again at once.
+ */
+class frame_pool {
+public:
+    static void *alloc(std::size_t size)
+    {
+        std::size_t cls = frame_class(size + sizeof(frame_header));
+        if (cls == frame_classes) {
+            return ::operator new(size, std::nothrow);
+        }
+
+        frame_state *s = tls_state != nullptr ? tls_state : adopt();
+        if (s == nullptr) {
+            return nullptr;
+        }
+        void *frame = take(s, cls);
+        if (tls_exited) {
+            park(s);
+        } else {
+            tls_state = s;
+            /* Makes sure frame_exit runs for this thread */
+            static_cast<void>(&tls_exit);
+        }
+        return frame;
+    }
+
+    static void free(void *ptr, std::size_t size)
+    {
+        if (frame_class(size + sizeof(frame_header)) == frame_classes) {
+            ::operator delete(ptr);
+            return;
+        }
+
+        frame_header *header = header_of(ptr);
+        frame_state *owner = header->owner;
+        free_frame *frame = static_cast<free_frame *>(ptr);
+        if (owner == tls_state) {
+            frame->next = owner->lists[header->cls];
+            owner->lists[header->cls] = frame;
+            return;
+        }
+
+        free_frame *head = owner->remote.load(std::memory_order_relaxed);
+        do {
+            frame->next = head;
+        } while (!owner->remote.compare_exchange_weak(head, frame, std::memory_order_release,
+                                                      std::memory_order_relaxed));
+    }
+
+private:
+    static frame_state *adopt()
+    {
+        {
+            std::lock_guard<std::mutex> guard(parked_mutex);
+            if (parked != nullptr) {
+                frame_state *s = parked;
+                parked = parked->next;
+                s->next = nullptr;
+                return s;
+            }
+        }
+
+        void *mem = ca_malloc(sizeof(frame_state) + frame_align);
+        if (mem == nullptr) {
+            return nullptr;
+        }
+        return new (align(mem)) frame_state();
+    }
+
+    static void *take(frame_state *s, std::size_t cls)
+    {
+        if (s->lists[cls] == nullptr) {
+            drain(s);
+        }
+        if (s->lists[cls] != nullptr) {
+            free_frame *frame = s->lists[cls];
+            s->lists[cls] = frame->next;
+            return frame;
+        }
+        return carve(s, cls);
+    }
+
+    /* ca_malloc only guarantees 4 byte alignment of the data area */
+    static void *align(void *ptr)
+    {
+        std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(ptr);
+        return reinterpret_cast<void *>((addr + frame_align - 1) & ~(std::uintptr_t) (frame_align - 1));
+    }
+
+    /* Sorts the frames other threads have handed back into s's lists */
+    static void drain(frame_state *s)
+    {
+        free_frame *frame = s->remote.exchange(nullptr, std::memory_order_acquire);
+        while (frame != nullptr) {
+            free_frame *next = frame->next;
+            std::size_t cls = header_of(frame)->cls;
+            frame->next = s->lists[cls];
+            s->lists[cls] = frame;
+            frame = next;
+        }
+    }
+
+    static void *carve(frame_state *s, std::size_t cls)
+    {
+        std::size_t cap = frame_min << cls;
+        if (s->bump_left < cap) {
+            /* The tail of the old chunk is smaller than this class; it is
+             * left unused rather than split into smaller frames */
+            void *mem = ca_malloc(frame_chunk);
+            if (mem == nullptr) {
+                return nullptr;
+            }
+            s->bump = static_cast<char *>(align(mem));
+            s->bump_left = frame_chunk - (s->bump - static_cast<char *>(mem));
+        }
+
+        frame_header *header = reinterpret_cast<frame_header *>(s->bump);
+        header->owner = s;
+        header->cls = cls;
+        s->bump += cap;
+        s->bump_left -= cap;
+        return header + 1;
+    }
+};
+
+} // namespace detail
+
+/**
+ * frame_alloc allocates a coroutine frame from the calling thread's pool
+ * @param size frame size
+ *
+ * @return pointer aligned to alignof(std::max_align_t), or NULL
+ */
+inline void *frame_alloc(std::size_t size)
+{
+    return detail::frame_pool::alloc(size);
+}
+
+/**
+ * frame_free returns a frame to the pool it was carved from, which may belong
+ * to another thread
+ * @param ptr frame from frame_alloc
+ * @param size the size that was passed to frame_alloc
+ */
+inline void frame_free(void *ptr, std::size_t size) noexcept
+{
+    detail::frame_pool::free(ptr, size);
+}
+
+/**
+ * frame_allocated is a base class for coroutine promise types. The compiler
+ * looks up operator new and operator delete in the promise type when it
+ * allocates a coroutine's frame, so deriving from it routes every frame of
+ * that coroutine type through frame_alloc. The sized delete is required: the
+ * frame size selects the size class on the way back.
+ */
+struct frame_allocated {
+    static void *operator new(std::size_t size)
+    {
+        void *ptr = frame_alloc(size);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    static void operator delete(void *ptr, std::size_t size) noexcept
+    {
+        frame_free(ptr, size);
+    }
+};
+
+} // namespace ca
+
+#endif
@@ -0,0 +1,153 @@
+/**
+ * @file
+ *
+ * io_uring fixed-buffer pool. All buffers live in one mapping that is
+ * registered once when the pool is created; allocation and free push and pop
+ * buffer indices on a stack, so both are O(1) and the index needed by fixed
+ * reads and writes is known without a lookup.
+ */
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "iopool.h"
+#include "logger.h"
+
+/**
+ * Pool metadata. The iovec array and the free index stack are laid out
+ * directly after this struct in the same mapping.
+ */
+struct iobuf_pool {
+    int ring_fd; /*!< Ring the buffers are registered with */
+    char *base; /*!< Start of the buffer region */
+    size_t buf_size; /*!< Size of each buffer */
+    unsigned int count; /*!< Number of buffers */
+    unsigned int top; /*!< Number of entries on the free stack */
+    size_t meta_size; /*!< Size of the metadata mapping */
+    pthread_mutex_t lock; /*!< Protects the free stack */
+    struct iovec *iovecs; /*!< One iovec per buffer, as registered */
+    unsigned int *free_stack; /*!< Indices of free buffers */
+};
+
+struct iobuf_pool *iobuf_pool_create(int ring_fd, size_t buf_size, unsigned int count)
+{
+    size_t page_size = getpagesize();
+    if (count == 0 || buf_size == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    /* Neither the rounded buffers nor the metadata may wrap around */
+    if (buf_size > SIZE_MAX - page_size + 1
+            || (buf_size + page_size - 1) / page_size > SIZE_MAX / page_size / count
+            || count > (SIZE_MAX - sizeof(struct iobuf_pool) - page_size)
+                / (sizeof(struct iovec) + sizeof(unsigned int))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    buf_size = (buf_size + page_size - 1) & ~(page_size - 1);
+
+    size_t meta_size = sizeof(struct iobuf_pool)
+        + count * (sizeof(struct iovec) + sizeof(unsigned int));
+    meta_size = (meta_size + page_size - 1) & ~(page_size - 1);
+    struct iobuf_pool *pool = mmap(NULL, meta_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pool == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    /* Registration pins the pages anyway, so populate them up front */
+    char *base = mmap(NULL, buf_size * count, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (base == MAP_FAILED) {
+        int error = errno;
+        perror("mmap");
+        munmap(pool, meta_size);
+        errno = error;
+        return NULL;
+    }
+
+    pool->ring_fd = ring_fd;
+    pool->base = base;
+    pool->buf_size = buf_size;
+    pool->count = count;
+    pool->meta_size = meta_size;
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->iovecs = (struct iovec *) (pool + 1);
+    pool->free_stack = (unsigned int *) (pool->iovecs + count);
+    for (unsigned int i = 0; i < count; i++) {
+        pool->iovecs[i].iov_base = base + (size_t) i * buf_size;
+        pool->iovecs[i].iov_len = buf_size;
+        /* Hand out low indices first */
+        pool->free_stack[i] = count - 1 - i;
+    }
+    pool->top = count;
+
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS,
+                pool->iovecs, count) < 0) {
+        int error = errno;
+        perror("io_uring_register");
+        munmap(base, buf_size * count);
+        munmap(pool, meta_size);
+        errno = error;
+        return NULL;
+    }
+    LOG("Registered %u buffers of %zu bytes at %p\n", count, buf_size, base);
+    return pool;
+}
+
+int iobuf_pool_destroy(struct iobuf_pool *pool)
+{
+    if (pool == NULL) {
+        return 0;
+    }
+    int ret = 0;
+    if (syscall(__NR_io_uring_register, pool->ring_fd, IORING_UNREGISTER_BUFFERS,
+                NULL, 0) < 0) {
+        perror("io_uring_register");
+        ret = -1;
+    }
+    munmap(pool->base, pool->buf_size * pool->count);
+    pthread_mutex_destroy(&pool->lock);
+    munmap(pool, pool->meta_size);
+    return ret;
+}
+
+void *iobuf_alloc(struct iobuf_pool *pool, int *index)
+{
+    pthread_mutex_lock(&pool->lock);
+    if (pool->top == 0) {
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+    }
+    unsigned int i = pool->free_stack[--pool->top];
+    pthread_mutex_unlock(&pool->lock);
+
+    if (index != NULL) {
+        *index = i;
+    }
+    return pool->iovecs[i].iov_base;
+}
+
+void iobuf_free(struct iobuf_pool *pool, void *buf)
+{
+    if (buf == NULL) {
+        return;
+    }
+    unsigned int i = ((char *) buf - pool->base) / pool->buf_size;
+    pthread_mutex_lock(&pool->lock);
+    pool->free_stack[pool->top++] = i;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+size_t iobuf_size(struct iobuf_pool *pool)
+{
+    return pool->buf_size;
+}
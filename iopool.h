@@ -0,0 +1,61 @@
+/**
+ * @file
+ *
+ * Pool of I/O buffers registered once with io_uring so they can be used with
+ * IORING_OP_READ_FIXED / IORING_OP_WRITE_FIXED without per-I/O registration.
+ */
+
+#ifndef IOPOOL_H
+#define IOPOOL_H
+
+#include <stddef.h>
+
+struct iobuf_pool;
+
+/**
+ * iobuf_pool_create maps a single region holding `count` buffers and
+ * registers each buffer with the ring through io_uring_register_buffers.
+ * @param ring_fd file descriptor of the io_uring instance
+ * @param buf_size size of each buffer. Rounded up to the page size
+ * @param count number of buffers in the pool
+ *
+ * @return the new pool, or NULL with errno set: EINVAL for an empty pool,
+ * ENOMEM when its size doesn't fit a size_t, else from the mapping or the
+ * registration that failed
+ */
+struct iobuf_pool *iobuf_pool_create(int ring_fd, size_t buf_size, unsigned int count);
+
+/**
+ * iobuf_pool_destroy unregisters the pool's buffers and unmaps the pool
+ * @param pool the pool to destroy. All buffers must have been freed
+ *
+ * @return 0 on success, -1 if unregistering failed
+ */
+int iobuf_pool_destroy(struct iobuf_pool *pool);
+
+/**
+ * iobuf_alloc takes a buffer from the pool in O(1)
+ * @param pool the pool to allocate from
+ * @param index set to the buffer's registered index, which is what goes in
+ * the buf_index field of a fixed read/write SQE
+ *
+ * @return pointer to the buffer or NULL if the pool is exhausted
+ */
+void *iobuf_alloc(struct iobuf_pool *pool, int *index);
+
+/**
+ * iobuf_free returns a buffer to the pool in O(1)
+ * @param pool the pool the buffer came from
+ * @param buf pointer returned by iobuf_alloc
+ */
+void iobuf_free(struct iobuf_pool *pool, void *buf);
+
+/**
+ * iobuf_size returns the (rounded) size of the pool's buffers
+ * @param pool the pool
+ *
+ * @return size of each buffer in bytes
+ */
+size_t iobuf_size(struct iobuf_pool *pool);
+
+#endif
@@ -0,0 +1,85 @@
+/**
+ * @file
+ *
+ * Client for the allocator's control channel (see ALLOCATOR_CONTROL). Sends
+ * one command to a running process and prints the reply.
+ *
+ * Commands:
+ *   purge                          release the pages inside free blocks
+ *   set key:value[,key:value...]   change algorithm, scribble, sample, warm,
+ *                                  emptiness, overflow_budget or
+ *                                  overflow_threshold
+ *   stats                          counters and current settings
+ *   report                         the heap report (as for the report signal)
+ *   help                           list the commands
+ *
+ * Exits with 1 if the command failed or the process couldn't be reached.
+ *
+ * Usage: allocctl socket command [arguments]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s socket command [arguments]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, argv[1]);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    char command[512] = "";
+    size_t len = 0;
+    for (int i = 2; i < argc; i++) {
+        len += snprintf(command + len, sizeof(command) - len, "%s%s", i > 2 ? " " : "", argv[i]);
+        if (len >= sizeof(command) - 1) {
+            fprintf(stderr, "command too long\n");
+            return EXIT_FAILURE;
+        }
+    }
+    command[len++] = '\n';
+    if (write(fd, command, len) != (ssize_t) len) {
+        perror("write");
+        return EXIT_FAILURE;
+    }
+    shutdown(fd, SHUT_WR);
+
+    /* The reply ends with OK or ERR on a line of its own */
+    char buf[4096];
+    char last[64] = "";
+    size_t last_len = 0;
+    bool line_start = true;
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        fwrite(buf, 1, n, stdout);
+        for (ssize_t i = 0; i < n; i++) {
+            if (line_start) {
+                last_len = 0;
+            }
+            line_start = buf[i] == '\n';
+            if (!line_start && last_len < sizeof(last) - 1) {
+                last[last_len++] = buf[i];
+            }
+            last[last_len] = '\0';
+        }
+    }
+    close(fd);
+    return strcmp(last, "OK") == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
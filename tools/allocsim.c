@@ -0,0 +1,410 @@
+/**
+ * @file
+ *
+ * What-if capacity simulator. Replays a recorded allocation trace (see
+ * ALLOCATOR_TRACE) through the real placement engines, optionally scaled up,
+ * and reports the footprint the heap would reach.
+ *
+ * By default the allocator runs against a simulated page provider: regions
+ * come from one address range reserved up front, no system calls are made
+ * per region, and the data areas of allocations are never touched. Only the
+ * block headers are written, and peaks come from the provider's own counts
+ * rather than from allocator_stats() after every operation. With -R the trace
+ * is replayed for real (mmap'd regions, every allocation written) for
+ * comparison.
+ *
+ * Usage: allocsim [-a engines] [-c copies] [-s size scale] [-R] trace
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../allocator.h"
+
+#define SIM_RESERVE (256UL << 30) /*!< Address space backing the simulated pages */
+
+/**
+ * One operation from the trace.
+ */
+struct op {
+    char type; /*!< 'a' for an allocation, 'f' for a free */
+    uint64_t id; /*!< Allocation id (its address when it was recorded) */
+    size_t size; /*!< Requested size for allocations */
+};
+
+/**
+ * A free range of simulated address space.
+ */
+struct extent {
+    uintptr_t start;
+    uintptr_t end;
+};
+
+/**
+ * Live allocation in the id table. Linear probing, keyed by (id, copy).
+ */
+struct live {
+    uint64_t id;
+    unsigned int copy;
+    bool used;
+    void *ptr;
+    size_t size;
+};
+
+static char *g_sim_base; /*!< Start of the simulated address space */
+static uintptr_t g_sim_top; /*!< Everything above here is unused */
+static struct extent *g_sim_free; /*!< Free ranges below g_sim_top, by address */
+static size_t g_sim_num_free, g_sim_cap_free;
+static size_t g_mapped, g_peak_mapped; /*!< Simulated mapped bytes */
+static unsigned long g_mappings; /*!< Simulated mappings (regions, or filler hugepages) */
+
+static struct live *g_live; /*!< Live allocations by (id, copy) */
+static size_t g_live_mask;
+
+/**
+ * Simulated page provider: first fit over the free ranges, lowest address
+ * first, then the top of the used range. No memory is touched.
+ */
+static void *sim_map(size_t size, size_t align)
+{
+    uintptr_t start = 0;
+    for (size_t i = 0; i < g_sim_num_free && start == 0; i++) {
+        struct extent *ext = &g_sim_free[i];
+        uintptr_t aligned = (ext->start + align - 1) & ~(align - 1);
+        if (aligned + size > ext->end) {
+            continue;
+        }
+        start = aligned;
+        if (aligned > ext->start && aligned + size < ext->end) {
+            if (g_sim_num_free == g_sim_cap_free) {
+                g_sim_cap_free = g_sim_cap_free ? g_sim_cap_free * 2 : 1024;
+                g_sim_free = realloc(g_sim_free, g_sim_cap_free * sizeof(struct extent));
+                ext = &g_sim_free[i];
+            }
+            memmove(ext + 1, ext, (g_sim_num_free - i) * sizeof(struct extent));
+            g_sim_num_free++;
+            ext[0].end = aligned;
+            ext[1].start = aligned + size;
+        } else if (aligned > ext->start) {
+            ext->end = aligned;
+        } else if (aligned + size < ext->end) {
+            ext->start = aligned + size;
+        } else {
+            memmove(ext, ext + 1, (g_sim_num_free - i - 1) * sizeof(struct extent));
+            g_sim_num_free--;
+        }
+    }
+    if (start == 0) {
+        start = (g_sim_top + align - 1) & ~(align - 1);
+        if (start + size > (uintptr_t) g_sim_base + SIM_RESERVE) {
+            return MAP_FAILED;
+        }
+        /* The alignment gap is lost; the simulated heap never needs it back */
+        g_sim_top = start + size;
+    }
+    g_mapped += size;
+    g_mappings++;
+    if (g_mapped > g_peak_mapped) {
+        g_peak_mapped = g_mapped;
+    }
+    return (void *) start;
+}
+
+static int sim_unmap(void *addr, size_t size)
+{
+    uintptr_t start = (uintptr_t) addr, end = start + size;
+    g_mapped -= size;
+    g_mappings--;
+
+    size_t i = 0;
+    while (i < g_sim_num_free && g_sim_free[i].start < start) {
+        i++;
+    }
+    bool merge_prev = i > 0 && g_sim_free[i - 1].end == start;
+    bool merge_next = i < g_sim_num_free && g_sim_free[i].start == end;
+    if (merge_prev && merge_next) {
+        g_sim_free[i - 1].end = g_sim_free[i].end;
+        memmove(&g_sim_free[i], &g_sim_free[i + 1], (g_sim_num_free - i - 1) * sizeof(struct extent));
+        g_sim_num_free--;
+    } else if (merge_prev) {
+        g_sim_free[i - 1].end = end;
+    } else if (merge_next) {
+        g_sim_free[i].start = start;
+    } else {
+        if (g_sim_num_free == g_sim_cap_free) {
+            g_sim_cap_free = g_sim_cap_free ? g_sim_cap_free * 2 : 1024;
+            g_sim_free = realloc(g_sim_free, g_sim_cap_free * sizeof(struct extent));
+        }
+        memmove(&g_sim_free[i + 1], &g_sim_free[i], (g_sim_num_free - i) * sizeof(struct extent));
+        g_sim_free[i] = (struct extent) { start, end };
+        g_sim_num_free++;
+    }
+    if (g_sim_num_free > 0 && g_sim_free[g_sim_num_free - 1].end == g_sim_top) {
+        g_sim_top = g_sim_free[--g_sim_num_free].start;
+    }
+    return 0;
+}
+
+/**
+ * Grows a simulated mapping in place when the range right after it is unused,
+ * as mremap would, so regions extend like they do for real.
+ */
+static int sim_grow(void *addr, size_t size, size_t new_size)
+{
+    uintptr_t end = (uintptr_t) addr + size, new_end = (uintptr_t) addr + new_size;
+    if (end == g_sim_top) {
+        if (new_end > (uintptr_t) g_sim_base + SIM_RESERVE) {
+            return -1;
+        }
+        g_sim_top = new_end;
+    } else {
+        size_t i = 0;
+        while (i < g_sim_num_free && g_sim_free[i].start < end) {
+            i++;
+        }
+        if (i == g_sim_num_free || g_sim_free[i].start != end || g_sim_free[i].end < new_end) {
+            return -1;
+        }
+        if (g_sim_free[i].end > new_end) {
+            g_sim_free[i].start = new_end;
+        } else {
+            memmove(&g_sim_free[i], &g_sim_free[i + 1], (g_sim_num_free - i - 1) * sizeof(struct extent));
+            g_sim_num_free--;
+        }
+    }
+    g_mapped += new_size - size;
+    if (g_mapped > g_peak_mapped) {
+        g_peak_mapped = g_mapped;
+    }
+    return 0;
+}
+
+static struct live *live_find(uint64_t id, unsigned int copy)
+{
+    size_t i = (id * 0x9E3779B97F4A7C15UL + copy) & g_live_mask;
+    while (g_live[i].used && (g_live[i].id != id || g_live[i].copy != copy)) {
+        i = (i + 1) & g_live_mask;
+    }
+    return &g_live[i];
+}
+
+/**
+ * Removes an entry, shifting later entries of its probe run back so lookups
+ * never need tombstones.
+ */
+static void live_remove(struct live *entry)
+{
+    size_t i = entry - g_live;
+    g_live[i].used = false;
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & g_live_mask;
+        if (!g_live[j].used) {
+            break;
+        }
+        size_t home = (g_live[j].id * 0x9E3779B97F4A7C15UL + g_live[j].copy) & g_live_mask;
+        /* Move j back into the hole at i unless its home lies in (i, j] */
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+            g_live[i] = g_live[j];
+            g_live[j].used = false;
+            i = j;
+        }
+    }
+}
+
+static struct op *load_trace(const char *path, size_t *num_ops, size_t *max_live)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return NULL;
+    }
+    size_t cap = 1 << 16, count = 0, live = 0;
+    struct op *ops = malloc(cap * sizeof(struct op));
+    char line[256];
+    *max_live = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        struct op op = { 0 };
+        unsigned int thread;
+        unsigned long time;
+        if (line[0] == 'a' && sscanf(line, "a %u %lu %lx %zu", &thread, &time, &op.id, &op.size) == 4) {
+            op.type = 'a';
+            live++;
+        } else if (line[0] == 'f' && sscanf(line, "f %u %lu %lx", &thread, &time, &op.id) == 3) {
+            op.type = 'f';
+            live = live > 0 ? live - 1 : 0;
+        } else {
+            continue;
+        }
+        if (live > *max_live) {
+            *max_live = live;
+        }
+        if (count == cap) {
+            cap *= 2;
+            ops = realloc(ops, cap * sizeof(struct op));
+        }
+        ops[count++] = op;
+    }
+    fclose(file);
+    *num_ops = count;
+    return ops;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Replays `copies` interleaved copies of the trace with the engine chosen
+ * through the environment, and prints one line of results.
+ */
+static void simulate(const char *engine, struct op *ops, size_t num_ops, size_t max_live,
+        unsigned int copies, double scale, bool real)
+{
+    if (!real) {
+        g_sim_base = mmap(NULL, SIM_RESERVE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (g_sim_base == MAP_FAILED) {
+            perror("mmap");
+            exit(EXIT_FAILURE);
+        }
+        g_sim_top = (uintptr_t) g_sim_base;
+        allocator_set_page_provider(sim_map, sim_unmap, sim_grow);
+    }
+
+    size_t slots = 1024;
+    while (slots < max_live * copies * 2) {
+        slots *= 2;
+    }
+    g_live = calloc(slots, sizeof(struct live));
+    g_live_mask = slots - 1;
+
+    size_t live_bytes = 0, peak_live = 0;
+    unsigned long peak_regions = 0;
+    size_t frag_mapped = 0, frag_live = 0;
+    double start = now();
+    for (size_t i = 0; i < num_ops; i++) {
+        for (unsigned int copy = 0; copy < copies; copy++) {
+            struct op *op = &ops[i];
+            struct live *entry = live_find(op->id, copy);
+            if (entry->used) {
+                /* A free missing from the trace, or this is the free */
+                ca_free(entry->ptr);
+                live_bytes -= entry->size;
+                live_remove(entry);
+                if (op->type == 'f') {
+                    continue;
+                }
+                entry = live_find(op->id, copy);
+            }
+            if (op->type == 'f') {
+                continue;
+            }
+
+            size_t size = op->size * scale;
+            void *ptr = ca_malloc(size);
+            if (ptr == NULL) {
+                fprintf(stderr, "allocation of %zu bytes failed\n", size);
+                exit(EXIT_FAILURE);
+            }
+            if (real) {
+                memset(ptr, 0x5A, size);
+            }
+            *entry = (struct live) { op->id, copy, true, ptr, size };
+            live_bytes += size;
+            if (live_bytes > peak_live) {
+                peak_live = live_bytes;
+            }
+
+            /* The simulated provider sees every mapping, so only a real
+             * replay needs to ask the allocator */
+            size_t mapped = g_mapped;
+            unsigned long regions = g_mappings;
+            if (real) {
+                struct allocator_stats stats;
+                allocator_stats(&stats);
+                mapped = stats.region_bytes;
+                regions = stats.regions;
+            }
+            if (regions > peak_regions) {
+                peak_regions = regions;
+            }
+            if (mapped >= frag_mapped) {
+                frag_mapped = mapped;
+                frag_live = live_bytes;
+            }
+        }
+    }
+    double elapsed = now() - start;
+
+    size_t peak_mapped = real ? frag_mapped : g_peak_mapped;
+    double fragmentation = frag_mapped ? 100.0 * (1.0 - (double) frag_live / frag_mapped) : 0.0;
+    printf("%-10s %12zu %12zu %12zu %10lu %9.1f%% %9.3fs\n", engine, num_ops * copies,
+            peak_mapped, peak_live, peak_regions, fragmentation, elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+    char engines[256] = "first_fit,best_fit,worst_fit";
+    unsigned int copies = 1;
+    double scale = 1.0;
+    bool real = false;
+    int c;
+    while ((c = getopt(argc, argv, "a:c:s:R")) != -1) {
+        switch (c) {
+            case 'a':
+                snprintf(engines, sizeof(engines), "%s", optarg);
+                break;
+            case 'c':
+                copies = atoi(optarg);
+                break;
+            case 's':
+                scale = atof(optarg);
+                break;
+            case 'R':
+                real = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-a engines] [-c copies] [-s size scale] [-R] trace\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || copies == 0) {
+        fprintf(stderr, "Usage: %s [-a engines] [-c copies] [-s size scale] [-R] trace\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t num_ops, max_live;
+    struct op *ops = load_trace(argv[optind], &num_ops, &max_live);
+    if (ops == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    printf("%-10s %12s %12s %12s %10s %10s %10s\n", "engine", "ops", "peak mapped",
+            "peak live", "regions", "frag", "time");
+    fflush(stdout);
+    /* Each engine runs in its own process so it starts from an empty heap */
+    for (char *engine = strtok(engines, ","); engine != NULL; engine = strtok(NULL, ",")) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            setenv("ALLOCATOR_ALGORITHM", engine, 1);
+            simulate(engine, ops, num_ops, max_live, copies, scale, real);
+            fflush(stdout);
+            _exit(EXIT_SUCCESS);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    free(ops);
+    return 0;
+}
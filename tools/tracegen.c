@@ -0,0 +1,586 @@
+/**
+ * @file
+ *
+ * Synthetic trace generator. Fits the size, lifetime and inter-arrival
+ * distributions of a recorded allocation trace (see ALLOCATOR_TRACE), or
+ * takes them as explicit parameters, and writes a new trace in the same
+ * format for tools/allocsim and the benchmarks. Only the distributions make
+ * it into the output, so a synthetic trace can be shared where the recorded
+ * one can't, and it can be made longer, wider or heavier than the original.
+ *
+ * The model is a set of histograms:
+ *  - sizes, log-linear (8 buckets per power of two);
+ *  - lifetimes per power-of-two size class, in allocations made in the
+ *    meantime (the same clock as allocator_lifetimes()), log2 buckets, plus
+ *    the fraction of objects in the class that are never freed;
+ *  - gaps between a thread's consecutive allocations, log2 buckets of ns;
+ *  - the fraction of frees made by a thread other than the allocating one.
+ * Values are drawn uniformly within a bucket. Explicit parameters are turned
+ * into the same histograms by sampling them, so both modes generate alike.
+ *
+ * Knobs: -n allocations, -t threads, -p phases (alternate phases scale sizes
+ * by -m, so the heap's size mix shifts as in a program changing tasks), -H
+ * target live heap bytes (lifetimes are scaled to reach it), -s seed.
+ *
+ * Usage: tracegen [-f trace | -z min:max -l lifetime -i gap -I immortal]
+ *                 [-n allocations] [-t threads] [-p phases] [-m scale]
+ *                 [-H heap bytes] [-s seed] [-v]
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SIZE_SUB_BITS 3 /*!< log2 of size buckets per power of two */
+#define SIZE_BUCKETS (64 << SIZE_SUB_BITS)
+#define LOG_BUCKETS 64 /*!< Buckets of the log2 histograms */
+#define CLASS_MIN_SAMPLES 16 /*!< Lifetimes a size class needs to get its own histogram */
+#define EXPLICIT_SAMPLES 1000000 /*!< Draws used to turn parameters into histograms */
+#define HEAP_SAMPLES 100000 /*!< Draws used to estimate the live heap for -H */
+#define MAX_THREADS 1024
+
+/**
+ * Fitted distributions. Lifetimes are indexed by size class (floor(log2
+ * size)); class LOG_BUCKETS - 1 collects every lifetime, for classes with
+ * too few samples of their own.
+ */
+struct model {
+    uint64_t sizes[SIZE_BUCKETS];
+    uint64_t size_total;
+    uint64_t lifetimes[LOG_BUCKETS][LOG_BUCKETS];
+    uint64_t lifetime_total[LOG_BUCKETS];
+    uint64_t immortal[LOG_BUCKETS];
+    uint64_t gaps[LOG_BUCKETS];
+    uint64_t gap_total;
+    uint64_t frees;
+    uint64_t cross_frees;
+    unsigned int threads;
+};
+
+/**
+ * Allocation still live while fitting, keyed by id. Linear probing.
+ */
+struct fit_live {
+    uint64_t id;
+    bool used;
+    uint64_t birth; /*!< Allocation clock when it was allocated */
+    size_t size;
+    unsigned int thread;
+};
+
+/**
+ * Scheduled free in the generator's min-heap, ordered by death.
+ */
+struct death {
+    uint64_t at; /*!< Allocation clock at which the object is freed */
+    uint64_t id;
+    unsigned int thread;
+};
+
+static struct fit_live *g_fit_live;
+static size_t g_fit_mask;
+
+static struct death *g_deaths;
+static size_t g_num_deaths, g_cap_deaths;
+
+static uint64_t g_rng;
+
+/* xorshift64*: the generator must be reproducible for a given -s */
+static uint64_t rng_next(void)
+{
+    g_rng ^= g_rng >> 12;
+    g_rng ^= g_rng << 25;
+    g_rng ^= g_rng >> 27;
+    return g_rng * 0x2545F4914F6CDD1DUL;
+}
+
+/* Spreads a -s seed over the state with splitmix64, so every seed gives its
+ * own sequence; xorshift must not start from 0 */
+static void rng_seed(uint64_t seed)
+{
+    uint64_t z = seed + 0x9E3779B97F4A7C15UL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+    g_rng = z ^ (z >> 31);
+    if (g_rng == 0) {
+        g_rng = 0x9E3779B97F4A7C15UL;
+    }
+}
+
+static double rng_unit(void)
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int log2_floor(uint64_t value)
+{
+    return 63 - __builtin_clzll(value);
+}
+
+static int size_bucket(size_t size)
+{
+    if (size < (1 << SIZE_SUB_BITS)) {
+        return size;
+    }
+    int shift = log2_floor(size) - SIZE_SUB_BITS;
+    return ((shift + 1) << SIZE_SUB_BITS) + ((size >> shift) & ((1 << SIZE_SUB_BITS) - 1));
+}
+
+/* log2 bucket: 0 holds 0, bucket b > 0 holds [2^(b-1), 2^b) */
+static int log_bucket(uint64_t value)
+{
+    return value == 0 ? 0 : log2_floor(value) + 1;
+}
+
+static int size_class(size_t size)
+{
+    return size == 0 ? 0 : log2_floor(size);
+}
+
+/**
+ * Draws a bucket index from a histogram.
+ */
+static int sample_bucket(const uint64_t *histogram, int buckets, uint64_t total)
+{
+    uint64_t rank = rng_next() % total;
+    for (int i = 0; i < buckets; i++) {
+        if (rank < histogram[i]) {
+            return i;
+        }
+        rank -= histogram[i];
+    }
+    return buckets - 1;
+}
+
+static size_t sample_size(const struct model *model)
+{
+    int bucket = sample_bucket(model->sizes, SIZE_BUCKETS, model->size_total);
+    if (bucket < (1 << SIZE_SUB_BITS)) {
+        return bucket;
+    }
+    int shift = (bucket >> SIZE_SUB_BITS) - 1;
+    size_t low = ((size_t) (1 << SIZE_SUB_BITS) + (bucket & ((1 << SIZE_SUB_BITS) - 1))) << shift;
+    return low + rng_next() % ((size_t) 1 << shift);
+}
+
+static uint64_t sample_log(const uint64_t *histogram, uint64_t total)
+{
+    int bucket = sample_bucket(histogram, LOG_BUCKETS, total);
+    if (bucket == 0) {
+        return 0;
+    }
+    uint64_t low = 1UL << (bucket - 1);
+    return low + rng_next() % low;
+}
+
+/**
+ * Draws a lifetime for an object of `size` bytes.
+ *
+ * @return the lifetime in allocations, or UINT64_MAX if it is never freed
+ */
+static uint64_t sample_lifetime(const struct model *model, size_t size)
+{
+    int cls = size_class(size);
+    if (model->lifetime_total[cls] + model->immortal[cls] < CLASS_MIN_SAMPLES) {
+        cls = LOG_BUCKETS - 1;
+    }
+    uint64_t total = model->lifetime_total[cls] + model->immortal[cls];
+    if (total == 0 || rng_next() % total < model->immortal[cls]) {
+        return UINT64_MAX;
+    }
+    return sample_log(model->lifetimes[cls], model->lifetime_total[cls]);
+}
+
+static void add_lifetime(struct model *model, size_t size, uint64_t lifetime)
+{
+    int cls = size_class(size);
+    int bucket = log_bucket(lifetime);
+    model->lifetimes[cls][bucket]++;
+    model->lifetime_total[cls]++;
+    model->lifetimes[LOG_BUCKETS - 1][bucket]++;
+    model->lifetime_total[LOG_BUCKETS - 1]++;
+}
+
+static void add_immortal(struct model *model, size_t size)
+{
+    model->immortal[size_class(size)]++;
+    model->immortal[LOG_BUCKETS - 1]++;
+}
+
+static struct fit_live *fit_find(uint64_t id)
+{
+    size_t i = (id * 0x9E3779B97F4A7C15UL) & g_fit_mask;
+    while (g_fit_live[i].used && g_fit_live[i].id != id) {
+        i = (i + 1) & g_fit_mask;
+    }
+    return &g_fit_live[i];
+}
+
+/**
+ * Removes an entry, shifting later entries of its probe run back so lookups
+ * never need tombstones.
+ */
+static void fit_remove(struct fit_live *entry)
+{
+    size_t i = entry - g_fit_live;
+    g_fit_live[i].used = false;
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & g_fit_mask;
+        if (!g_fit_live[j].used) {
+            break;
+        }
+        size_t home = (g_fit_live[j].id * 0x9E3779B97F4A7C15UL) & g_fit_mask;
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+            g_fit_live[i] = g_fit_live[j];
+            g_fit_live[j].used = false;
+            i = j;
+        }
+    }
+}
+
+/**
+ * Fits the model to a recorded trace. Objects still live at the end of the
+ * trace count as never freed.
+ *
+ * @return false if the trace can't be read or holds no allocations
+ */
+static bool fit_trace(struct model *model, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+
+    size_t slots = 1 << 16, live = 0;
+    g_fit_live = calloc(slots, sizeof(struct fit_live));
+    g_fit_mask = slots - 1;
+    static uint64_t last_alloc[MAX_THREADS];
+    static bool seen[MAX_THREADS];
+    uint64_t clock = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        unsigned int thread;
+        uint64_t time, id;
+        size_t size;
+        if (line[0] == 'a' && sscanf(line, "a %u %lu %lx %zu", &thread, &time, &id, &size) == 4) {
+            thread %= MAX_THREADS;
+            model->sizes[size_bucket(size)]++;
+            model->size_total++;
+            if (seen[thread]) {
+                model->gaps[log_bucket(time - last_alloc[thread])]++;
+                model->gap_total++;
+            } else {
+                seen[thread] = true;
+                model->threads++;
+            }
+            last_alloc[thread] = time;
+
+            struct fit_live *entry = fit_find(id);
+            if (entry->used) {
+                /* Its free is missing from the trace */
+                add_immortal(model, entry->size);
+                fit_remove(entry);
+                live--;
+                entry = fit_find(id);
+            }
+            *entry = (struct fit_live) { id, true, clock++, size, thread };
+            if (++live * 2 > slots) {
+                /* Grow the table and reinsert everything */
+                struct fit_live *old = g_fit_live;
+                size_t old_slots = slots;
+                slots *= 2;
+                g_fit_live = calloc(slots, sizeof(struct fit_live));
+                g_fit_mask = slots - 1;
+                for (size_t i = 0; i < old_slots; i++) {
+                    if (old[i].used) {
+                        *fit_find(old[i].id) = old[i];
+                    }
+                }
+                free(old);
+            }
+        } else if (line[0] == 'f' && sscanf(line, "f %u %lu %lx", &thread, &time, &id) == 3) {
+            struct fit_live *entry = fit_find(id);
+            if (!entry->used) {
+                continue;
+            }
+            add_lifetime(model, entry->size, clock - entry->birth);
+            model->frees++;
+            if (entry->thread != thread % MAX_THREADS) {
+                model->cross_frees++;
+            }
+            fit_remove(entry);
+            live--;
+        }
+    }
+    fclose(file);
+
+    for (size_t i = 0; i < slots; i++) {
+        if (g_fit_live[i].used) {
+            add_immortal(model, g_fit_live[i].size);
+        }
+    }
+    free(g_fit_live);
+    if (model->size_total == 0) {
+        fprintf(stderr, "%s: no allocations in trace\n", path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Builds the model from explicit parameters: log-uniform sizes in
+ * [min_size, max_size], exponential lifetimes and gaps with the given means,
+ * and a fraction of objects that are never freed.
+ */
+static void fit_explicit(struct model *model, size_t min_size, size_t max_size,
+        double lifetime, double gap, double immortal)
+{
+    double lo = log(min_size), hi = log(max_size);
+    for (int i = 0; i < EXPLICIT_SAMPLES; i++) {
+        size_t size = exp(lo + (hi - lo) * rng_unit());
+        model->sizes[size_bucket(size)]++;
+        model->size_total++;
+        if (rng_unit() < immortal) {
+            add_immortal(model, size);
+        } else {
+            add_lifetime(model, size, -lifetime * log(1.0 - rng_unit()));
+        }
+        model->gaps[log_bucket(-gap * log(1.0 - rng_unit()))]++;
+        model->gap_total++;
+    }
+    model->threads = 1;
+}
+
+static void print_model(const struct model *model)
+{
+    uint64_t bytes = 0, lifetimes = 0;
+    for (int i = 0; i < 100000; i++) {
+        bytes += sample_size(model);
+        lifetimes += model->lifetime_total[LOG_BUCKETS - 1]
+            ? sample_log(model->lifetimes[LOG_BUCKETS - 1], model->lifetime_total[LOG_BUCKETS - 1])
+            : 0;
+    }
+    fprintf(stderr, "model: %lu allocations from %u threads, mean size %.1f, "
+            "mean lifetime %.1f allocations, %.1f%% never freed, %.1f%% freed by another thread\n",
+            model->size_total, model->threads, bytes / 100000.0, lifetimes / 100000.0,
+            100.0 * model->immortal[LOG_BUCKETS - 1] / model->size_total,
+            model->frees ? 100.0 * model->cross_frees / model->frees : 0.0);
+}
+
+/**
+ * Estimates the live heap the model reaches in steady state, by Little's
+ * law: each allocation keeps its size live for its lifetime, counted in
+ * allocations, so the live bytes are the mean of size * lifetime.
+ */
+static double steady_heap(const struct model *model)
+{
+    double total = 0;
+    for (int i = 0; i < HEAP_SAMPLES; i++) {
+        size_t size = sample_size(model);
+        uint64_t lifetime = sample_lifetime(model, size);
+        if (lifetime != UINT64_MAX) {
+            total += (double) size * lifetime;
+        }
+    }
+    return total / HEAP_SAMPLES;
+}
+
+static void death_push(struct death death)
+{
+    if (g_num_deaths == g_cap_deaths) {
+        g_cap_deaths = g_cap_deaths ? g_cap_deaths * 2 : 1024;
+        g_deaths = realloc(g_deaths, g_cap_deaths * sizeof(struct death));
+    }
+    size_t i = g_num_deaths++;
+    while (i > 0 && g_deaths[(i - 1) / 2].at > death.at) {
+        g_deaths[i] = g_deaths[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    g_deaths[i] = death;
+}
+
+static struct death death_pop(void)
+{
+    struct death top = g_deaths[0];
+    struct death last = g_deaths[--g_num_deaths];
+    size_t i = 0;
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= g_num_deaths) {
+            break;
+        }
+        if (child + 1 < g_num_deaths && g_deaths[child + 1].at < g_deaths[child].at) {
+            child++;
+        }
+        if (g_deaths[child].at >= last.at) {
+            break;
+        }
+        g_deaths[i] = g_deaths[child];
+        i = child;
+    }
+    g_deaths[i] = last;
+    return top;
+}
+
+/**
+ * Writes the synthetic trace. Each thread allocates after gaps drawn from
+ * the model; threads are merged in time order. Before each allocation, the
+ * objects whose lifetime has run out are freed, by their own thread or, as
+ * often as in the model, by another one. Objects still live at the end are
+ * left unfreed, as in a recorded trace.
+ */
+static void generate(const struct model *model, uint64_t allocations, unsigned int threads,
+        unsigned int phases, double phase_scale, double lifetime_scale)
+{
+    static uint64_t next_time[MAX_THREADS];
+    for (unsigned int t = 0; t < threads; t++) {
+        next_time[t] = sample_log(model->gaps, model->gap_total);
+    }
+    double cross = model->frees ? (double) model->cross_frees / model->frees : 0.0;
+
+    for (uint64_t clock = 0; clock < allocations; clock++) {
+        unsigned int thread = 0;
+        for (unsigned int t = 1; t < threads; t++) {
+            if (next_time[t] < next_time[thread]) {
+                thread = t;
+            }
+        }
+        uint64_t time = next_time[thread];
+        next_time[thread] += sample_log(model->gaps, model->gap_total);
+
+        while (g_num_deaths > 0 && g_deaths[0].at <= clock) {
+            struct death death = death_pop();
+            unsigned int by = death.thread;
+            if (threads > 1 && rng_unit() < cross) {
+                by = (by + 1 + rng_next() % (threads - 1)) % threads;
+            }
+            printf("f %u %lu %lx\n", by + 1, time, death.id);
+        }
+
+        size_t size = sample_size(model);
+        if (phases > 1 && (clock * phases / allocations) % 2 == 1) {
+            size = size * phase_scale;
+        }
+        /* Ids look like addresses, and are never reused */
+        uint64_t id = 0x100000 + clock * 16;
+        printf("a %u %lu %lx %zu\n", thread + 1, time, id, size);
+
+        uint64_t lifetime = sample_lifetime(model, size);
+        if (lifetime != UINT64_MAX) {
+            death_push((struct death) {
+                clock + 1 + (uint64_t) (lifetime * lifetime_scale), id, thread,
+            });
+        }
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-f trace | -z min:max -l lifetime -i gap -I immortal]\n"
+            "       [-n allocations] [-t threads] [-p phases] [-m scale] [-H heap bytes] [-s seed] [-v]\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *trace = NULL;
+    size_t min_size = 16, max_size = 4096;
+    double lifetime = 1000, gap = 1000, immortal = 0;
+    uint64_t allocations = 1000000;
+    unsigned int threads = 0, phases = 1;
+    double phase_scale = 4;
+    double heap = 0;
+    bool verbose = false;
+    rng_seed(1);
+    int c;
+    while ((c = getopt(argc, argv, "f:z:l:i:I:n:t:p:m:H:s:v")) != -1) {
+        switch (c) {
+            case 'f':
+                trace = optarg;
+                break;
+            case 'z':
+                if (sscanf(optarg, "%zu:%zu", &min_size, &max_size) != 2
+                        || min_size == 0 || max_size < min_size) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                lifetime = atof(optarg);
+                break;
+            case 'i':
+                gap = atof(optarg);
+                break;
+            case 'I':
+                immortal = atof(optarg);
+                break;
+            case 'n':
+                allocations = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'p':
+                phases = atoi(optarg);
+                break;
+            case 'm':
+                phase_scale = atof(optarg);
+                break;
+            case 'H':
+                heap = atof(optarg);
+                break;
+            case 's':
+                rng_seed(strtoull(optarg, NULL, 10));
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc || threads > MAX_THREADS) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    static struct model model;
+    if (trace != NULL) {
+        if (!fit_trace(&model, trace)) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        fit_explicit(&model, min_size, max_size, lifetime, gap, immortal);
+    }
+    if (model.gap_total == 0) {
+        /* A single allocation per thread; any gap will do */
+        model.gaps[log_bucket(gap)]++;
+        model.gap_total++;
+    }
+    if (threads == 0) {
+        threads = model.threads;
+    }
+
+    double lifetime_scale = 1.0;
+    if (heap > 0) {
+        double steady = steady_heap(&model);
+        if (steady > 0) {
+            lifetime_scale = heap / steady;
+        }
+    }
+    if (verbose) {
+        print_model(&model);
+        fprintf(stderr, "generating %lu allocations on %u threads, %u phases, lifetimes x%.3f\n",
+                allocations, threads, phases, lifetime_scale);
+    }
+
+    generate(&model, allocations, threads, phases, phase_scale, lifetime_scale);
+    return 0;
+}